@@ -1,12 +1,39 @@
 #include <GL/glew.h>
 #include <GL/freeglut.h>
 #include <iostream>
+#include <chrono>
+#include <cstdio>
 
 // Macro for indexing vertex buffer
 #define BUFFER_OFFSET(i) ((char *)NULL + (i))
 
 using namespace std;
 
+// Everything the frame needs is created once in init(), display() only binds and draws
+GLuint shaderProgramIDs[2];
+GLuint VAOs[2];
+GLuint VBOs[2];
+
+// Instrumentation for the overlay: how many GL objects this sample has created, and how long frames take.
+// Both should stay flat once init() is done, if they grow the render loop is creating objects again.
+struct GLObjectCounts
+{
+	GLuint programs;
+	GLuint shaders;
+	GLuint vertexArrays;
+	GLuint buffers;
+};
+
+GLObjectCounts objectCounts = { 0, 0, 0, 0 };
+
+// Frame times are averaged over this many frames before the overlay updates
+const int FRAME_STATS_WINDOW = 60;
+
+chrono::steady_clock::time_point lastFrame;
+double frameTimeSum = 0.0, frameTimeMax = 0.0;
+int framesInWindow = 0;
+char overlayText[256] = "measuring...";
+
 // Vertex Shader (for convenience, it is defined in the main here, but we will be using text files for shaders in future)
 // Note: Input to this shader is the vertex positions that we specified for the triangle. 
 // Note: gl_Position is a special built-in variable that is supposed to contain the vertex position (in X, Y, Z, W)
@@ -75,6 +102,7 @@ static void AddShader(GLuint ShaderProgram, const char* pShaderText, GLenum Shad
 	}
 	// Attach the compiled shader object to the program object
 	glAttachShader(ShaderProgram, ShaderObj);
+	objectCounts.shaders++;
 }
 
 GLuint CompileShaders(const char * pVS, const char * pFS)
@@ -86,6 +114,7 @@ GLuint CompileShaders(const char * pVS, const char * pFS)
 		fprintf(stderr, "Error creating shader program\n");
 		exit(1);
 	}
+	objectCounts.programs++;
 
 	// Create two shader objects, one for the vertex, and one for the fragment shader
 	AddShader(shaderProgramID, pVS, GL_VERTEX_SHADER);
@@ -129,6 +158,7 @@ GLuint generateObjectBuffer(GLfloat vertices[], GLfloat colors[])
 	// Generate 1 generic buffer object, called VBO
 	GLuint VBO;
 	glGenBuffers(1, &VBO);
+	objectCounts.buffers++;
 	// In OpenGL, we bind (make active) the handle to a target name and then execute commands on that target
 	// Buffer will contain an array of vertices 
 	glBindBuffer(GL_ARRAY_BUFFER, VBO);
@@ -136,7 +166,7 @@ GLuint generateObjectBuffer(GLfloat vertices[], GLfloat colors[])
 	glBufferData(GL_ARRAY_BUFFER, numVertices * 7 * sizeof(GLfloat), NULL, GL_STATIC_DRAW);
 	// if you have more data besides vertices (e.g., vertex colours or normals), use glBufferSubData to tell the buffer when the vertices array ends and when the colors start
 	glBufferSubData(GL_ARRAY_BUFFER, 0, numVertices * 3 * sizeof(GLfloat), vertices);
-	glBufferSubData(GL_ARRAY_BUFFER, numVertices * 3 * sizeof(GLfloat), numVertices * 3 * sizeof(GLfloat), colors);
+	glBufferSubData(GL_ARRAY_BUFFER, numVertices * 3 * sizeof(GLfloat), numVertices * 4 * sizeof(GLfloat), colors);
 	return VBO;
 }
 
@@ -156,12 +186,54 @@ void linkCurrentBuffertoShader(GLuint shaderProgramID)
 }
 #pragma endregion VBO_FUNCTIONS
 
+// Updates the frame time statistics and draws them, together with the GL object counts, in the bottom left corner
+void drawOverlay()
+{
+	chrono::steady_clock::time_point now = chrono::steady_clock::now();
+	double frameTime = chrono::duration<double, milli>(now - lastFrame).count();
+	lastFrame = now;
+
+	frameTimeSum += frameTime;
+	frameTimeMax = frameTime > frameTimeMax ? frameTime : frameTimeMax;
+
+	if (++framesInWindow == FRAME_STATS_WINDOW)
+	{
+		snprintf(overlayText, sizeof(overlayText), "frame %.2f ms avg, %.2f ms max | programs %u shaders %u VAOs %u buffers %u",
+			frameTimeSum / framesInWindow, frameTimeMax, objectCounts.programs, objectCounts.shaders, objectCounts.vertexArrays, objectCounts.buffers);
+		frameTimeSum = 0.0;
+		frameTimeMax = 0.0;
+		framesInWindow = 0;
+	}
+
+	// The text goes through the fixed function pipeline, so step out of our program and VAO first
+	glUseProgram(0);
+	glBindVertexArray(0);
+	glColor3f(1.0f, 1.0f, 1.0f);
+	glWindowPos2i(10, 10);
+	glutBitmapString(GLUT_BITMAP_HELVETICA_12, (const unsigned char *)overlayText);
+}
+
 void display() {
 	
 	glClear(GL_COLOR_BUFFER_BIT);
-	GLuint VAOs[2];
-	glGenVertexArrays(2, VAOs);
 
+	// NB: Make the call to draw the geometry in the currently activated vertex buffer. This is where the GPU starts to work!	
+	for (int i = 0; i < 2; i++)
+	{
+		glUseProgram(shaderProgramIDs[i]);
+		glBindVertexArray(VAOs[i]);
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+	}
+
+	drawOverlay();
+	glutSwapBuffers();
+	// Keep redrawing so the overlay always shows the steady state
+	glutPostRedisplay();
+}
+
+
+void init()
+{
 	// Create 3 vertices that make up a triangle that fits on the viewport 
 	GLfloat vertices[] = { -0.9f, -0.5f, 0.0f,
 						  -0.0f,-0.5f,0.0f,
@@ -176,25 +248,24 @@ void display() {
 						0.0f, 1.0f, 0.0f, 1.0f,
 						0.0f, 0.0f, 1.0f, 1.0f };
 
+	// Set up the shaders, one per triangle colour
+	shaderProgramIDs[0] = CompileShaders(pVS, pFS);
+	shaderProgramIDs[1] = CompileShaders(pVS, pFS1);
 
-	// Set up the shaders
+	glGenVertexArrays(2, VAOs);
+	objectCounts.vertexArrays += 2;
 
-	GLuint shaderProgramID = CompileShaders(pVS, pFS);
+	// Put the vertices and colors into a vertex buffer object and record the attribute layout in the VAO
 	glBindVertexArray(VAOs[0]);
-	// Put the vertices and colors into a vertex buffer object
-	VAOs[0] = generateObjectBuffer(vertices, colors);
-	// Link the current buffer to the shader
-	linkCurrentBuffertoShader(shaderProgramID);
-	glDrawArrays(GL_TRIANGLES, 0, 3);
+	VBOs[0] = generateObjectBuffer(vertices, colors);
+	linkCurrentBuffertoShader(shaderProgramIDs[0]);
 
-	GLuint shaderProgramID1 = CompileShaders(pVS, pFS1);
 	glBindVertexArray(VAOs[1]);
-	VAOs[1] = generateObjectBuffer(vertices2, colors);
-	linkCurrentBuffertoShader(shaderProgramID1);
-	glDrawArrays(GL_TRIANGLES, 0, 3);
-	
-	glutSwapBuffers();
-	// NB: Make the call to draw the geometry in the currently activated vertex buffer. This is where the GPU starts to work!	
+	VBOs[1] = generateObjectBuffer(vertices2, colors);
+	linkCurrentBuffertoShader(shaderProgramIDs[1]);
+
+	glBindVertexArray(0);
+	lastFrame = chrono::steady_clock::now();
 }
 
 
@@ -218,7 +289,7 @@ int main(int argc, char** argv) {
 		return 1;
 	}
 	// Set up your objects and shaders
-
+	init();
 	// Begin infinite event loop
 	glutMainLoop();
 	return 0;
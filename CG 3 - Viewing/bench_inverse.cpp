@@ -0,0 +1,112 @@
+// micro-benchmark for the special-case inverses in maths_funcs against the
+// general 4x4 inverse(). not part of the viewer - build it on its own, e.g.
+//   g++ -O2 -o bench_inverse bench_inverse.cpp maths_funcs.cpp
+//   cl /O2 /EHsc bench_inverse.cpp maths_funcs.cpp
+// it checks every fast path against the general one on random transforms
+// first and exits with 1 if any of them disagree
+#include "maths_funcs.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <chrono>
+
+#define TRANSFORM_COUNT 1000
+#define CALL_COUNT 5000000
+// absolute, per element. the translations go up to 50, where a float step is
+// about 4e-6, and the two paths round differently - on this data affine_inverse
+// ends up about 3e-5 off, rigid_inverse 1.5e-5 and inverse_transpose_3x3 4e-7
+#define TOLERANCE 1e-4f
+
+static float random_float (float lo, float hi) {
+	return lo + (hi - lo) * (float)rand () / (float)RAND_MAX;
+}
+
+// any mix of rotation, non-uniform scale and translation
+static mat4 random_affine () {
+	mat4 m = identity_mat4 ();
+	m = scale (m, vec3 (random_float (0.5f, 2.0f), random_float (0.5f, 2.0f), random_float (0.5f, 2.0f)));
+	m = rotate_x_deg (m, random_float (0.0f, 360.0f));
+	m = rotate_y_deg (m, random_float (0.0f, 360.0f));
+	m = rotate_z_deg (m, random_float (0.0f, 360.0f));
+	return translate (m, vec3 (random_float (-50.0f, 50.0f), random_float (-50.0f, 50.0f), random_float (-50.0f, 50.0f)));
+}
+
+// a view matrix, rotation and translation only
+static mat4 random_rigid () {
+	vec3 cam_pos (random_float (-50.0f, 50.0f), random_float (-50.0f, 50.0f), random_float (-50.0f, 50.0f));
+	vec3 targ_pos (random_float (-50.0f, 50.0f), random_float (-50.0f, 50.0f), random_float (-50.0f, 50.0f));
+	return look_at (cam_pos, targ_pos, vec3 (0.0f, 1.0f, 0.0f));
+}
+
+static float max_diff (const float* a, const float* b, int count) {
+	float diff = 0.0f;
+	for (int i = 0; i < count; i++) {
+		diff = fmaxf (diff, fabsf (a[i] - b[i]));
+	}
+	return diff;
+}
+
+// upper-left 3x3 of a mat4, as a mat3 (the constructor takes rows)
+static mat3 upper_3x3 (const mat4& m) {
+	return mat3 (
+		m.m[0], m.m[4], m.m[8],
+		m.m[1], m.m[5], m.m[9],
+		m.m[2], m.m[6], m.m[10]
+	);
+}
+
+// runs f over the transforms CALL_COUNT times and returns ns per call. the
+// results are summed into sink so the calls can't be optimised away
+template <typename F>
+static double time_ns (const mat4* transforms, F f, float* sink) {
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now ();
+	for (int i = 0; i < CALL_COUNT; i++) {
+		*sink += f (transforms[i % TRANSFORM_COUNT]);
+	}
+	std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now ();
+	return std::chrono::duration<double, std::nano> (end - start).count () / CALL_COUNT;
+}
+
+static float general_inverse (const mat4& m) { return inverse (m).m[12]; }
+static float fast_affine_inverse (const mat4& m) { return affine_inverse (m).m[12]; }
+static float fast_rigid_inverse (const mat4& m) { return rigid_inverse (m).m[12]; }
+static float general_normal (const mat4& m) { return transpose (inverse (m)).m[1]; }
+static float fast_normal (const mat4& m) { return inverse_transpose_3x3 (m).m[1]; }
+
+int main () {
+	static mat4 affine[TRANSFORM_COUNT];
+	static mat4 rigid[TRANSFORM_COUNT];
+	srand (1);
+	for (int i = 0; i < TRANSFORM_COUNT; i++) {
+		affine[i] = random_affine ();
+		rigid[i] = random_rigid ();
+	}
+
+	float affine_diff = 0.0f, rigid_diff = 0.0f, normal_diff = 0.0f;
+	for (int i = 0; i < TRANSFORM_COUNT; i++) {
+		affine_diff = fmaxf (affine_diff, max_diff (affine_inverse (affine[i]).m, inverse (affine[i]).m, 16));
+		rigid_diff = fmaxf (rigid_diff, max_diff (rigid_inverse (rigid[i]).m, inverse (rigid[i]).m, 16));
+		mat3 normal = inverse_transpose_3x3 (affine[i]);
+		mat3 expected = upper_3x3 (transpose (inverse (affine[i])));
+		normal_diff = fmaxf (normal_diff, max_diff (normal.m, expected.m, 9));
+	}
+	printf ("max difference from the general path over %i transforms:\n", TRANSFORM_COUNT);
+	printf ("  affine_inverse         %g\n", affine_diff);
+	printf ("  rigid_inverse          %g\n", rigid_diff);
+	printf ("  inverse_transpose_3x3  %g\n", normal_diff);
+	if (affine_diff > TOLERANCE || rigid_diff > TOLERANCE || normal_diff > TOLERANCE) {
+		fprintf (stderr, "ERROR: a fast inverse disagrees with inverse() by more than %g\n", TOLERANCE);
+		return 1;
+	}
+
+	float sink = 0.0f;
+	printf ("time per call over %i calls:\n", CALL_COUNT);
+	printf ("  inverse                %6.1f ns\n", time_ns (affine, general_inverse, &sink));
+	printf ("  affine_inverse         %6.1f ns\n", time_ns (affine, fast_affine_inverse, &sink));
+	printf ("  rigid_inverse          %6.1f ns\n", time_ns (rigid, fast_rigid_inverse, &sink));
+	printf ("  transpose(inverse)     %6.1f ns\n", time_ns (affine, general_normal, &sink));
+	printf ("  inverse_transpose_3x3  %6.1f ns\n", time_ns (affine, fast_normal, &sink));
+	// printed so the compiler has to keep every call
+	printf ("(checksum %g)\n", sink);
+	return 0;
+}
@@ -3,6 +3,23 @@
 #define _USE_MATH_DEFINES
 #include <math.h>
 
+// pick a SIMD back-end for the mat4 kernels from the compiler's target flags
+// (-mavx / /arch:AVX, plain x86-64 SSE, or ARM NEON). define
+// MATHS_FUNCS_NO_SIMD to build with the scalar reference code only
+#if !defined(MATHS_FUNCS_NO_SIMD)
+#if defined(__AVX__)
+#define MATHS_FUNCS_AVX
+#define MATHS_FUNCS_SSE
+#include <immintrin.h>
+#elif defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define MATHS_FUNCS_SSE
+#include <xmmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define MATHS_FUNCS_NEON
+#include <arm_neon.h>
+#endif
+#endif
+
 /*-----------------------------------CONSTRUCTORS-------------------------------------*/
 
 vec2::vec2 () {}
@@ -298,43 +315,107 @@ mat4 identity_mat4 () {
 3 7 11 15
 */
 
-vec4 mat4::operator* (const vec4& rhs) {
+vec4 mul_scalar (const mat4& a, const vec4& rhs) {
+	const float* m = a.m;
 	float x = m[0] * rhs.v[0] + m[4] * rhs.v[1] + m[8] * rhs.v[2] + m[12] * rhs.v[3]; // 0x + 4y + 8z + 12w
 	float y = m[1] * rhs.v[0] + m[5] * rhs.v[1] + m[9] * rhs.v[2] + m[13] * rhs.v[3]; // 1x + 5y + 9z + 13w
 	float z = m[2] * rhs.v[0] + m[6] * rhs.v[1] + m[10] * rhs.v[2] + m[14] * rhs.v[3]; // 2x + 6y + 10z + 14w
 	float w = m[3] * rhs.v[0] + m[7] * rhs.v[1] + m[11] * rhs.v[2] + m[15] * rhs.v[3]; // 3x + 7y + 11z + 15w
 	return vec4 (x, y, z, w);
 }
-/*
-mat4 mat4::operator* (const mat4& rhs) {
+
+mat4 mul_scalar (const mat4& a, const mat4& rhs) {
 	mat4 r = zero_mat4 ();
 	int r_index = 0;
 	for (int col = 0; col < 4; col++) {
 		for (int row = 0; row < 4; row++) {
 			float sum = 0.0f;
 			for (int i = 0; i < 4; i++) {
-				sum += m[i + col * 4] * rhs.m[row + i * 4];
+				sum += rhs.m[i + col * 4] * a.m[row + i * 4];
 			}
 			r.m[r_index] = sum;
 			r_index++;
 		}
 	}
 	return r;
-}*/
+}
+
+// result = col0 * x + col1 * y + col2 * z + col3 * w, one column per register
+vec4 mat4::operator* (const vec4& rhs) {
+#if defined(MATHS_FUNCS_SSE)
+	vec4 r;
+	__m128 acc = _mm_mul_ps (_mm_load_ps (m), _mm_set1_ps (rhs.v[0]));
+	acc = _mm_add_ps (acc, _mm_mul_ps (_mm_load_ps (m + 4), _mm_set1_ps (rhs.v[1])));
+	acc = _mm_add_ps (acc, _mm_mul_ps (_mm_load_ps (m + 8), _mm_set1_ps (rhs.v[2])));
+	acc = _mm_add_ps (acc, _mm_mul_ps (_mm_load_ps (m + 12), _mm_set1_ps (rhs.v[3])));
+	_mm_store_ps (r.v, acc);
+	return r;
+#elif defined(MATHS_FUNCS_NEON)
+	vec4 r;
+	float32x4_t acc = vmulq_n_f32 (vld1q_f32 (m), rhs.v[0]);
+	acc = vaddq_f32 (acc, vmulq_n_f32 (vld1q_f32 (m + 4), rhs.v[1]));
+	acc = vaddq_f32 (acc, vmulq_n_f32 (vld1q_f32 (m + 8), rhs.v[2]));
+	acc = vaddq_f32 (acc, vmulq_n_f32 (vld1q_f32 (m + 12), rhs.v[3]));
+	vst1q_f32 (r.v, acc);
+	return r;
+#else
+	return mul_scalar (*this, rhs);
+#endif
+}
+
+/* each column of the result is this matrix times the matching column of rhs,
+so the same column-combination trick as above is used 4 times. the AVX path
+does 2 result columns per 256-bit register (unaligned, mat4 is only
+16-byte aligned) */
 mat4 mat4::operator* (const mat4& rhs) {
-	mat4 r = zero_mat4 ();
-	int r_index = 0;
+#if defined(MATHS_FUNCS_AVX)
+	mat4 r;
+	__m256 c0 = _mm256_broadcast_ps ((const __m128*)(m));
+	__m256 c1 = _mm256_broadcast_ps ((const __m128*)(m + 4));
+	__m256 c2 = _mm256_broadcast_ps ((const __m128*)(m + 8));
+	__m256 c3 = _mm256_broadcast_ps ((const __m128*)(m + 12));
+	for (int col = 0; col < 4; col += 2) {
+		__m256 b = _mm256_loadu_ps (rhs.m + col * 4);
+		__m256 acc = _mm256_mul_ps (c0, _mm256_permute_ps (b, 0x00));
+		acc = _mm256_add_ps (acc, _mm256_mul_ps (c1, _mm256_permute_ps (b, 0x55)));
+		acc = _mm256_add_ps (acc, _mm256_mul_ps (c2, _mm256_permute_ps (b, 0xAA)));
+		acc = _mm256_add_ps (acc, _mm256_mul_ps (c3, _mm256_permute_ps (b, 0xFF)));
+		_mm256_storeu_ps (r.m + col * 4, acc);
+	}
+	return r;
+#elif defined(MATHS_FUNCS_SSE)
+	mat4 r;
+	__m128 c0 = _mm_load_ps (m);
+	__m128 c1 = _mm_load_ps (m + 4);
+	__m128 c2 = _mm_load_ps (m + 8);
+	__m128 c3 = _mm_load_ps (m + 12);
 	for (int col = 0; col < 4; col++) {
-		for (int row = 0; row < 4; row++) {
-			float sum = 0.0f;
-			for (int i = 0; i < 4; i++) {
-				sum += rhs.m[i + col * 4] * m[row + i * 4];
-			}
-			r.m[r_index] = sum;
-			r_index++;
-		}
+		const float* b = rhs.m + col * 4;
+		__m128 acc = _mm_mul_ps (c0, _mm_set1_ps (b[0]));
+		acc = _mm_add_ps (acc, _mm_mul_ps (c1, _mm_set1_ps (b[1])));
+		acc = _mm_add_ps (acc, _mm_mul_ps (c2, _mm_set1_ps (b[2])));
+		acc = _mm_add_ps (acc, _mm_mul_ps (c3, _mm_set1_ps (b[3])));
+		_mm_store_ps (r.m + col * 4, acc);
 	}
 	return r;
+#elif defined(MATHS_FUNCS_NEON)
+	mat4 r;
+	float32x4_t c0 = vld1q_f32 (m);
+	float32x4_t c1 = vld1q_f32 (m + 4);
+	float32x4_t c2 = vld1q_f32 (m + 8);
+	float32x4_t c3 = vld1q_f32 (m + 12);
+	for (int col = 0; col < 4; col++) {
+		const float* b = rhs.m + col * 4;
+		float32x4_t acc = vmulq_n_f32 (c0, b[0]);
+		acc = vaddq_f32 (acc, vmulq_n_f32 (c1, b[1]));
+		acc = vaddq_f32 (acc, vmulq_n_f32 (c2, b[2]));
+		acc = vaddq_f32 (acc, vmulq_n_f32 (c3, b[3]));
+		vst1q_f32 (r.m + col * 4, acc);
+	}
+	return r;
+#else
+	return mul_scalar (*this, rhs);
+#endif
 }
 
 mat4& mat4::operator= (const mat4& rhs) {
@@ -413,6 +494,77 @@ mat4 transpose (const mat4& mm) {
 	);
 }
 
+// cofactors of the upper-left 3x3 of a mat4, c[row * 3 + col], and the determinant
+// of that 3x3. shared by affine_inverse and inverse_transpose_3x3
+static float cofactors_3x3 (const mat4& mm, float* c) {
+	float a00 = mm.m[0], a01 = mm.m[4], a02 = mm.m[8];
+	float a10 = mm.m[1], a11 = mm.m[5], a12 = mm.m[9];
+	float a20 = mm.m[2], a21 = mm.m[6], a22 = mm.m[10];
+	c[0] = a11 * a22 - a12 * a21;
+	c[1] = a12 * a20 - a10 * a22;
+	c[2] = a10 * a21 - a11 * a20;
+	c[3] = a02 * a21 - a01 * a22;
+	c[4] = a00 * a22 - a02 * a20;
+	c[5] = a01 * a20 - a00 * a21;
+	c[6] = a01 * a12 - a02 * a11;
+	c[7] = a02 * a10 - a00 * a12;
+	c[8] = a00 * a11 - a01 * a10;
+	return a00 * c[0] + a01 * c[1] + a02 * c[2];
+}
+
+/* inverse of [A t; 0 1] is [inv(A) -inv(A)*t; 0 1], so only a 3x3 inverse is
+needed instead of the full 4x4 cofactor expansion above. roughly 4x faster
+than inverse () */
+mat4 affine_inverse (const mat4& mm) {
+	float c[9];
+	float det = cofactors_3x3 (mm, c);
+	if (0.0f == det) {
+		printf ("WARNING. matrix has no determinant. can not invert");
+		return mm;
+	}
+	float inv_det = 1.0f / det;
+	// inv(A) is the transposed cofactor matrix over the determinant
+	float b00 = c[0] * inv_det, b01 = c[3] * inv_det, b02 = c[6] * inv_det;
+	float b10 = c[1] * inv_det, b11 = c[4] * inv_det, b12 = c[7] * inv_det;
+	float b20 = c[2] * inv_det, b21 = c[5] * inv_det, b22 = c[8] * inv_det;
+	float tx = mm.m[12], ty = mm.m[13], tz = mm.m[14];
+	return mat4 (
+		b00, b01, b02, -(b00 * tx + b01 * ty + b02 * tz),
+		b10, b11, b12, -(b10 * tx + b11 * ty + b12 * tz),
+		b20, b21, b22, -(b20 * tx + b21 * ty + b22 * tz),
+		0.0f, 0.0f, 0.0f, 1.0f
+	);
+}
+
+// for an orthonormal rotation inv(R) is just transpose(R), so there is no
+// determinant at all. used for view matrices from look_at
+mat4 rigid_inverse (const mat4& mm) {
+	float tx = mm.m[12], ty = mm.m[13], tz = mm.m[14];
+	return mat4 (
+		mm.m[0], mm.m[1], mm.m[2], -(mm.m[0] * tx + mm.m[1] * ty + mm.m[2] * tz),
+		mm.m[4], mm.m[5], mm.m[6], -(mm.m[4] * tx + mm.m[5] * ty + mm.m[6] * tz),
+		mm.m[8], mm.m[9], mm.m[10], -(mm.m[8] * tx + mm.m[9] * ty + mm.m[10] * tz),
+		0.0f, 0.0f, 0.0f, 1.0f
+	);
+}
+
+// transpose(inverse(A)) is the cofactor matrix over the determinant, which
+// saves doing the inverse and the transpose separately
+mat3 inverse_transpose_3x3 (const mat4& mm) {
+	float c[9];
+	float det = cofactors_3x3 (mm, c);
+	if (0.0f == det) {
+		printf ("WARNING. matrix has no determinant. can not invert");
+		return identity_mat3 ();
+	}
+	float inv_det = 1.0f / det;
+	return mat3 (
+		c[0] * inv_det, c[1] * inv_det, c[2] * inv_det,
+		c[3] * inv_det, c[4] * inv_det, c[5] * inv_det,
+		c[6] * inv_det, c[7] * inv_det, c[8] * inv_det
+	);
+}
+
 /*--------------------------------AFFINE MATRIX FUNCTIONS-----------------------------*/
 
 // translate a 4d matrix with xyz array
@@ -469,6 +621,193 @@ mat4 scale (const mat4& m, const vec3& v) {
 	return a * m;
 }
 
+/*--------------------------------BATCH TRANSFORM FUNCTIONS---------------------------*/
+
+/* all of these work on 4 vertices at a time (8 for the AVX soa path) with one
+matrix element per register, i.e. the vertices are processed as x, y and z
+lanes. the aos vec3 versions shuffle each block of 4 into that form and back.
+leftover vertices go through the scalar code at the bottom of each loop */
+
+#if defined(MATHS_FUNCS_SSE)
+// x = m0 * x + m4 * y + m8 * z (+ m12) and so on for y and z
+static inline void transform_block_sse (const mat4& m, __m128& x, __m128& y, __m128& z, bool point) {
+	__m128 rx = _mm_add_ps (_mm_add_ps (_mm_mul_ps (_mm_set1_ps (m.m[0]), x), _mm_mul_ps (_mm_set1_ps (m.m[4]), y)), _mm_mul_ps (_mm_set1_ps (m.m[8]), z));
+	__m128 ry = _mm_add_ps (_mm_add_ps (_mm_mul_ps (_mm_set1_ps (m.m[1]), x), _mm_mul_ps (_mm_set1_ps (m.m[5]), y)), _mm_mul_ps (_mm_set1_ps (m.m[9]), z));
+	__m128 rz = _mm_add_ps (_mm_add_ps (_mm_mul_ps (_mm_set1_ps (m.m[2]), x), _mm_mul_ps (_mm_set1_ps (m.m[6]), y)), _mm_mul_ps (_mm_set1_ps (m.m[10]), z));
+	if (point) {
+		rx = _mm_add_ps (rx, _mm_set1_ps (m.m[12]));
+		ry = _mm_add_ps (ry, _mm_set1_ps (m.m[13]));
+		rz = _mm_add_ps (rz, _mm_set1_ps (m.m[14]));
+	}
+	x = rx;
+	y = ry;
+	z = rz;
+}
+#endif
+
+#if defined(MATHS_FUNCS_AVX)
+static inline void transform_block_avx (const mat4& m, __m256& x, __m256& y, __m256& z, bool point) {
+	__m256 rx = _mm256_add_ps (_mm256_add_ps (_mm256_mul_ps (_mm256_set1_ps (m.m[0]), x), _mm256_mul_ps (_mm256_set1_ps (m.m[4]), y)), _mm256_mul_ps (_mm256_set1_ps (m.m[8]), z));
+	__m256 ry = _mm256_add_ps (_mm256_add_ps (_mm256_mul_ps (_mm256_set1_ps (m.m[1]), x), _mm256_mul_ps (_mm256_set1_ps (m.m[5]), y)), _mm256_mul_ps (_mm256_set1_ps (m.m[9]), z));
+	__m256 rz = _mm256_add_ps (_mm256_add_ps (_mm256_mul_ps (_mm256_set1_ps (m.m[2]), x), _mm256_mul_ps (_mm256_set1_ps (m.m[6]), y)), _mm256_mul_ps (_mm256_set1_ps (m.m[10]), z));
+	if (point) {
+		rx = _mm256_add_ps (rx, _mm256_set1_ps (m.m[12]));
+		ry = _mm256_add_ps (ry, _mm256_set1_ps (m.m[13]));
+		rz = _mm256_add_ps (rz, _mm256_set1_ps (m.m[14]));
+	}
+	x = rx;
+	y = ry;
+	z = rz;
+}
+#endif
+
+#if defined(MATHS_FUNCS_NEON)
+static inline void transform_block_neon (const mat4& m, float32x4x3_t& p, bool point) {
+	float32x4_t rx = vaddq_f32 (vaddq_f32 (vmulq_n_f32 (p.val[0], m.m[0]), vmulq_n_f32 (p.val[1], m.m[4])), vmulq_n_f32 (p.val[2], m.m[8]));
+	float32x4_t ry = vaddq_f32 (vaddq_f32 (vmulq_n_f32 (p.val[0], m.m[1]), vmulq_n_f32 (p.val[1], m.m[5])), vmulq_n_f32 (p.val[2], m.m[9]));
+	float32x4_t rz = vaddq_f32 (vaddq_f32 (vmulq_n_f32 (p.val[0], m.m[2]), vmulq_n_f32 (p.val[1], m.m[6])), vmulq_n_f32 (p.val[2], m.m[10]));
+	if (point) {
+		rx = vaddq_f32 (rx, vdupq_n_f32 (m.m[12]));
+		ry = vaddq_f32 (ry, vdupq_n_f32 (m.m[13]));
+		rz = vaddq_f32 (rz, vdupq_n_f32 (m.m[14]));
+	}
+	p.val[0] = rx;
+	p.val[1] = ry;
+	p.val[2] = rz;
+}
+#endif
+
+static void transform_vec3s (const mat4& m, const vec3* in, vec3* out, int count, bool point) {
+	int i = 0;
+#if defined(MATHS_FUNCS_SSE)
+	for (; i + 4 <= count; i += 4) {
+		// x0 y0 z0 x1 | y1 z1 x2 y2 | z2 x3 y3 z3
+		const float* src = in[i].v;
+		__m128 v0 = _mm_loadu_ps (src);
+		__m128 v1 = _mm_loadu_ps (src + 4);
+		__m128 v2 = _mm_loadu_ps (src + 8);
+		__m128 x = _mm_shuffle_ps (v0, _mm_shuffle_ps (v1, v2, _MM_SHUFFLE (1, 1, 2, 2)), _MM_SHUFFLE (2, 0, 3, 0));
+		__m128 y = _mm_shuffle_ps (_mm_shuffle_ps (v0, v1, _MM_SHUFFLE (0, 0, 1, 1)), _mm_shuffle_ps (v1, v2, _MM_SHUFFLE (2, 2, 3, 3)), _MM_SHUFFLE (2, 0, 2, 0));
+		__m128 z = _mm_shuffle_ps (_mm_shuffle_ps (v0, v1, _MM_SHUFFLE (1, 1, 2, 2)), v2, _MM_SHUFFLE (3, 0, 2, 0));
+		transform_block_sse (m, x, y, z, point);
+		float* dst = out[i].v;
+		_mm_storeu_ps (dst, _mm_shuffle_ps (_mm_shuffle_ps (x, y, _MM_SHUFFLE (0, 0, 0, 0)), _mm_shuffle_ps (z, x, _MM_SHUFFLE (1, 1, 0, 0)), _MM_SHUFFLE (2, 0, 2, 0)));
+		_mm_storeu_ps (dst + 4, _mm_shuffle_ps (_mm_shuffle_ps (y, z, _MM_SHUFFLE (1, 1, 1, 1)), _mm_shuffle_ps (x, y, _MM_SHUFFLE (2, 2, 2, 2)), _MM_SHUFFLE (2, 0, 2, 0)));
+		_mm_storeu_ps (dst + 8, _mm_shuffle_ps (_mm_shuffle_ps (z, x, _MM_SHUFFLE (3, 3, 2, 2)), _mm_shuffle_ps (y, z, _MM_SHUFFLE (3, 3, 3, 3)), _MM_SHUFFLE (2, 0, 2, 0)));
+	}
+#elif defined(MATHS_FUNCS_NEON)
+	for (; i + 4 <= count; i += 4) {
+		// vld3 does the de-interleave for us
+		float32x4x3_t p = vld3q_f32 (in[i].v);
+		transform_block_neon (m, p, point);
+		vst3q_f32 (out[i].v, p);
+	}
+#endif
+	float w = point ? 1.0f : 0.0f;
+	for (; i < count; i++) {
+		vec4 r = mul_scalar (m, vec4 (in[i], w));
+		out[i] = vec3 (r);
+	}
+}
+
+void transform_points (const mat4& m, const vec3* in, vec3* out, int count) {
+	transform_vec3s (m, in, out, count, true);
+}
+
+void transform_directions (const mat4& m, const vec3* in, vec3* out, int count) {
+	transform_vec3s (m, in, out, count, false);
+}
+
+// vec4s already have one vertex per register, so this is just operator* without the temporaries
+void transform_points (const mat4& m, const vec4* in, vec4* out, int count) {
+#if defined(MATHS_FUNCS_SSE)
+	__m128 c0 = _mm_load_ps (m.m);
+	__m128 c1 = _mm_load_ps (m.m + 4);
+	__m128 c2 = _mm_load_ps (m.m + 8);
+	__m128 c3 = _mm_load_ps (m.m + 12);
+	for (int i = 0; i < count; i++) {
+		const float* p = in[i].v;
+		__m128 acc = _mm_mul_ps (c0, _mm_set1_ps (p[0]));
+		acc = _mm_add_ps (acc, _mm_mul_ps (c1, _mm_set1_ps (p[1])));
+		acc = _mm_add_ps (acc, _mm_mul_ps (c2, _mm_set1_ps (p[2])));
+		acc = _mm_add_ps (acc, _mm_mul_ps (c3, _mm_set1_ps (p[3])));
+		_mm_store_ps (out[i].v, acc);
+	}
+#elif defined(MATHS_FUNCS_NEON)
+	float32x4_t c0 = vld1q_f32 (m.m);
+	float32x4_t c1 = vld1q_f32 (m.m + 4);
+	float32x4_t c2 = vld1q_f32 (m.m + 8);
+	float32x4_t c3 = vld1q_f32 (m.m + 12);
+	for (int i = 0; i < count; i++) {
+		const float* p = in[i].v;
+		float32x4_t acc = vmulq_n_f32 (c0, p[0]);
+		acc = vaddq_f32 (acc, vmulq_n_f32 (c1, p[1]));
+		acc = vaddq_f32 (acc, vmulq_n_f32 (c2, p[2]));
+		acc = vaddq_f32 (acc, vmulq_n_f32 (c3, p[3]));
+		vst1q_f32 (out[i].v, acc);
+	}
+#else
+	for (int i = 0; i < count; i++) {
+		out[i] = mul_scalar (m, in[i]);
+	}
+#endif
+}
+
+static void transform_soa (const mat4& m, const float* x, const float* y, const float* z,
+													 float* out_x, float* out_y, float* out_z, int count, bool point) {
+	int i = 0;
+#if defined(MATHS_FUNCS_AVX)
+	for (; i + 8 <= count; i += 8) {
+		__m256 vx = _mm256_loadu_ps (x + i);
+		__m256 vy = _mm256_loadu_ps (y + i);
+		__m256 vz = _mm256_loadu_ps (z + i);
+		transform_block_avx (m, vx, vy, vz, point);
+		_mm256_storeu_ps (out_x + i, vx);
+		_mm256_storeu_ps (out_y + i, vy);
+		_mm256_storeu_ps (out_z + i, vz);
+	}
+#endif
+#if defined(MATHS_FUNCS_SSE)
+	for (; i + 4 <= count; i += 4) {
+		__m128 vx = _mm_loadu_ps (x + i);
+		__m128 vy = _mm_loadu_ps (y + i);
+		__m128 vz = _mm_loadu_ps (z + i);
+		transform_block_sse (m, vx, vy, vz, point);
+		_mm_storeu_ps (out_x + i, vx);
+		_mm_storeu_ps (out_y + i, vy);
+		_mm_storeu_ps (out_z + i, vz);
+	}
+#elif defined(MATHS_FUNCS_NEON)
+	for (; i + 4 <= count; i += 4) {
+		float32x4x3_t p;
+		p.val[0] = vld1q_f32 (x + i);
+		p.val[1] = vld1q_f32 (y + i);
+		p.val[2] = vld1q_f32 (z + i);
+		transform_block_neon (m, p, point);
+		vst1q_f32 (out_x + i, p.val[0]);
+		vst1q_f32 (out_y + i, p.val[1]);
+		vst1q_f32 (out_z + i, p.val[2]);
+	}
+#endif
+	float w = point ? 1.0f : 0.0f;
+	for (; i < count; i++) {
+		vec4 r = mul_scalar (m, vec4 (x[i], y[i], z[i], w));
+		out_x[i] = r.v[0];
+		out_y[i] = r.v[1];
+		out_z[i] = r.v[2];
+	}
+}
+
+void transform_points_soa (const mat4& m, const float* x, const float* y, const float* z,
+													 float* out_x, float* out_y, float* out_z, int count) {
+	transform_soa (m, x, y, z, out_x, out_y, out_z, count, true);
+}
+
+void transform_directions_soa (const mat4& m, const float* x, const float* y, const float* z,
+															 float* out_x, float* out_y, float* out_z, int count) {
+	transform_soa (m, x, y, z, out_x, out_y, out_z, count, false);
+}
+
 /*------------------------------3D SCENE MATRIX FUNCTIONS-----------------------------*/
 
 // returns a view matrix using the opengl lookAt style. COLUMN ORDER.
@@ -50,7 +50,9 @@ struct vec3 {
 	float v[3];
 };
 
-struct vec4 {
+// vec4 and mat4 are kept 16-byte aligned so the SIMD kernels in
+// maths_funcs.cpp can load whole columns with aligned loads
+struct alignas(16) vec4 {
 	vec4 ();
 	vec4 (float x, float y, float z, float w);
 	vec4 (const vec2& vv, float z, float w);
@@ -75,7 +77,7 @@ struct mat3 {
 1 5 9  13
 2 6 10 14
 3 7 11 15*/
-struct mat4 {
+struct alignas(16) mat4 {
 	mat4 ();
 	mat4 (float a, float b, float c, float d,
 				float e, float f, float g, float h,
@@ -111,6 +113,13 @@ float get_squared_dist (vec3 from, vec3 to);
 float direction_to_heading (vec3 d);
 vec3 heading_to_direction (float degrees);
 // matrix functions
+// plain scalar versions of mat4::operator*, kept as a reference for the
+// SSE/AVX/NEON kernels. the SIMD paths sum in the same order and don't
+// use fma, so results match these bit-for-bit (unless the compiler is
+// allowed to contract the scalar code into fma, e.g. -mfma without
+// -ffp-contract=off)
+mat4 mul_scalar (const mat4& a, const mat4& b);
+vec4 mul_scalar (const mat4& a, const vec4& v);
 mat3 zero_mat3 ();
 mat3 identity_mat3 ();
 mat4 zero_mat4 ();
@@ -118,12 +127,30 @@ mat4 identity_mat4 ();
 float determinant (const mat4& mm);
 mat4 inverse (const mat4& mm);
 mat4 transpose (const mat4& mm);
+// cheaper inverses for matrices with a bottom row of 0 0 0 1, i.e. anything
+// built from translate/rotate_*_deg/scale/look_at. they round differently to
+// inverse(), bench_inverse.cpp checks they agree with it to within 1e-4
+mat4 affine_inverse (const mat4& mm);
+// only valid when the 3x3 part is a pure rotation (no scale), e.g. look_at
+mat4 rigid_inverse (const mat4& mm);
+// normal matrix - inverse transpose of the upper-left 3x3
+mat3 inverse_transpose_3x3 (const mat4& mm);
 // affine functions
 mat4 translate (const mat4& m, const vec3& v);
 mat4 rotate_x_deg (const mat4& m, float deg);
 mat4 rotate_y_deg (const mat4& m, float deg);
 mat4 rotate_z_deg (const mat4& m, float deg);
 mat4 scale (const mat4& m, const vec3& v);
+// batch transforms - apply one matrix to a whole vertex stream. points get
+// w = 1 (translation applied), directions get w = 0. in and out may be the
+// same array. the _soa versions take separate x, y and z arrays
+void transform_points (const mat4& m, const vec3* in, vec3* out, int count);
+void transform_directions (const mat4& m, const vec3* in, vec3* out, int count);
+void transform_points (const mat4& m, const vec4* in, vec4* out, int count);
+void transform_points_soa (const mat4& m, const float* x, const float* y, const float* z,
+												 float* out_x, float* out_y, float* out_z, int count);
+void transform_directions_soa (const mat4& m, const float* x, const float* y, const float* z,
+														 float* out_x, float* out_y, float* out_z, int count);
 // camera functions
 mat4 look_at (const vec3& cam_pos, vec3 targ_pos, const vec3& up);
 mat4 perspective (float fovy, float aspect, float near, float far);
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <new>
+#include <cstdlib>
+
+// Counts heap allocations made through the global operator new, so the render loop can check that its hot paths
+// don't allocate. Counts are per thread, the loader threads allocating in the background don't show up on the render
+// thread.
+// Only debug and benchmark builds define COUNT_ALLOCATIONS. That replaces the global operator new/delete, so include
+// this in exactly one translation unit. Without it nothing is replaced and Get() stays 0.
+namespace AllocationCounter
+{
+	inline size_t &Counter()
+	{
+		static thread_local size_t count = 0;
+		return count;
+	}
+
+	// Allocations made by the calling thread so far
+	inline size_t Get()
+	{
+		return Counter();
+	}
+
+	inline bool IsEnabled()
+	{
+#ifdef COUNT_ALLOCATIONS
+		return true;
+#else
+		return false;
+#endif
+	}
+}
+
+#ifdef COUNT_ALLOCATIONS
+void *operator new(size_t size)
+{
+	AllocationCounter::Counter()++;
+
+	void *memory = malloc(size ? size : 1);
+
+	if (!memory)
+	{
+		throw std::bad_alloc();
+	}
+
+	return memory;
+}
+
+void operator delete(void *memory) noexcept
+{
+	free(memory);
+}
+#endif
@@ -0,0 +1,516 @@
+#pragma once
+
+#include <vector>
+#include <random>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <algorithm>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "Mesh.h"
+#include "ThreadPool.h"
+#include "Simd.h"
+
+// Define ASTEROID_BELT_NO_SIMD to force the scalar kernel here alone
+#if defined(SOLAR_SSE2) && !defined(ASTEROID_BELT_NO_SIMD)
+#define ASTEROID_BELT_SSE
+#endif
+
+using namespace std;
+
+// Per-instance data of one rock, as read by asteroidVertex.txt (attribute locations 3 and 4)
+struct AsteroidInstance
+{
+	// xyz: position in world space, w: uniform scale
+	glm::vec4 positionScale;
+	// xyz: unit spin axis, w: spin angle in radians
+	glm::vec4 spin;
+};
+
+// A procedurally generated ring of rocks on circular, slightly inclined orbits around the origin.
+//  - Orbital parameters live in structure-of-arrays form and the positions are recomputed every frame by an SSE
+//    kernel, split over the thread pool.
+//  - The kernel writes straight into a persistently mapped, triple buffered instance buffer (ARB_buffer_storage),
+//    guarded by fences. Without the extension it falls back to orphaning and mapping a plain buffer every frame.
+//  - Every rock is the same low poly mesh, drawn with one instanced call.
+// Update timings are accumulated for PrintStats.
+class AsteroidBelt
+{
+public:
+	AsteroidBelt(ThreadPool &pool, GLuint count, GLfloat innerRadius, GLfloat outerRadius, unsigned int seed = 1234)
+		: pool(pool), count(count), region(0), frames(0), updateMs(0.0), waitMs(0.0), jobTime(0.0f), jobDst(NULL), jobsPending(0)
+	{
+		this->generateOrbits(innerRadius, outerRadius, seed);
+		this->setupRock(seed);
+		this->splitJobs();
+
+		this->regionSize = (GLsizeiptr)count * sizeof(AsteroidInstance);
+		// An empty belt gets a one byte buffer, GL rejects zero sized storage
+		this->persistent = GL_FALSE != GLEW_ARB_buffer_storage && count > 0;
+
+		glGenBuffers(1, &this->instanceVBO);
+		glBindBuffer(GL_ARRAY_BUFFER, this->instanceVBO);
+
+		if (this->persistent)
+		{
+			const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+			glBufferStorage(GL_ARRAY_BUFFER, this->regionSize * REGION_COUNT, NULL, flags);
+			this->mapped = (AsteroidInstance *)glMapBufferRange(GL_ARRAY_BUFFER, 0, this->regionSize * REGION_COUNT, flags);
+
+			if (!this->mapped)
+			{
+				// Immutable storage can't be respecified, start over with a plain buffer
+				cout << "WARNING::ASTEROID_BELT:: persistent mapping failed, orphaning the buffer every frame instead" << endl;
+				glDeleteBuffers(1, &this->instanceVBO);
+				glGenBuffers(1, &this->instanceVBO);
+				glBindBuffer(GL_ARRAY_BUFFER, this->instanceVBO);
+				this->persistent = false;
+			}
+		}
+
+		if (!this->persistent)
+		{
+			glBufferData(GL_ARRAY_BUFFER, max<GLsizeiptr>(1, this->regionSize), NULL, GL_STREAM_DRAW);
+			this->mapped = NULL;
+		}
+
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+		for (GLuint i = 0; i < REGION_COUNT; i++)
+		{
+			this->fences[i] = 0;
+		}
+	}
+
+	~AsteroidBelt()
+	{
+		for (GLuint i = 0; i < REGION_COUNT; i++)
+		{
+			if (this->fences[i])
+			{
+				glDeleteSync(this->fences[i]);
+			}
+		}
+
+		if (this->mapped)
+		{
+			glBindBuffer(GL_ARRAY_BUFFER, this->instanceVBO);
+			glUnmapBuffer(GL_ARRAY_BUFFER);
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
+		}
+
+		glDeleteBuffers(1, &this->instanceVBO);
+		glDeleteBuffers(1, &this->VBO);
+		glDeleteVertexArrays(1, &this->VAO);
+	}
+
+	// Moves every rock to where it is at the given time. Call once per frame on the GL thread, before Draw.
+	void Update(GLfloat time)
+	{
+		if (0 == this->count)
+		{
+			return;
+		}
+
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		AsteroidInstance *dst;
+
+		if (this->persistent)
+		{
+			// Wait until the GPU is done with the draw that last read this region, normally it was two frames ago
+			this->region = (this->region + 1) % REGION_COUNT;
+
+			if (this->fences[this->region])
+			{
+				while (GL_TIMEOUT_EXPIRED == glClientWaitSync(this->fences[this->region], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000))
+				{
+				}
+
+				glDeleteSync(this->fences[this->region]);
+				this->fences[this->region] = 0;
+			}
+
+			dst = this->mapped + (size_t)this->region * this->count;
+		}
+		else
+		{
+			glBindBuffer(GL_ARRAY_BUFFER, this->instanceVBO);
+			glBufferData(GL_ARRAY_BUFFER, this->regionSize, NULL, GL_STREAM_DRAW);
+			dst = (AsteroidInstance *)glMapBufferRange(GL_ARRAY_BUFFER, 0, this->regionSize, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+		}
+
+		chrono::steady_clock::time_point mappedAt = chrono::steady_clock::now();
+
+		if (dst)
+		{
+			this->updateParallel(time, dst);
+		}
+
+		if (!this->persistent)
+		{
+			if (dst)
+			{
+				glUnmapBuffer(GL_ARRAY_BUFFER);
+			}
+
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
+		}
+
+		chrono::steady_clock::time_point end = chrono::steady_clock::now();
+		this->waitMs += chrono::duration<double, milli>(mappedAt - start).count();
+		this->updateMs += chrono::duration<double, milli>(end - mappedAt).count();
+		this->frames++;
+	}
+
+	// Draws every rock with one call. The shader (asteroidVertex.txt) must be in use with its uniforms set.
+	void Draw()
+	{
+		if (0 == this->count)
+		{
+			return;
+		}
+
+		glBindVertexArray(this->VAO);
+
+		// Point the instance attributes at the region Update just wrote
+		GLsizeiptr offset = this->persistent ? this->region * this->regionSize : 0;
+		glBindBuffer(GL_ARRAY_BUFFER, this->instanceVBO);
+		glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(AsteroidInstance), (GLvoid *)(offset + offsetof(AsteroidInstance, positionScale)));
+		glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, sizeof(AsteroidInstance), (GLvoid *)(offset + offsetof(AsteroidInstance, spin)));
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+		glDrawArraysInstanced(GL_TRIANGLES, 0, this->rockVertexCount, this->count);
+		glBindVertexArray(0);
+
+		if (this->persistent)
+		{
+			this->fences[this->region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		}
+	}
+
+	GLuint GetCount() const
+	{
+		return this->count;
+	}
+
+	// Benchmark summary: the CPU cost of the update kernel and how many instances per second it sustains, and from
+	// that how many rocks would fit in the update's share of the target frame time
+	void PrintStats(double averageFrameMs, double targetFrameMs) const
+	{
+		if (0 == this->frames || 0 == this->count)
+		{
+			return;
+		}
+
+		double updateMs = this->updateMs / this->frames;
+		// Below the clock's resolution there is no meaningful rate
+		double instancesPerSecond = updateMs > 0.0 ? this->count / (updateMs / 1000.0) : 0.0;
+
+		cout << "Asteroid belt: " << this->count << " instances, " << (this->persistent ? "persistently mapped" : "orphaned") << " buffer, "
+			<< this->pool.GetThreadCount() << " threads" << endl;
+		cout << "  update " << updateMs << " ms/frame (" << instancesPerSecond / 1.0e6 << " M instances/s), fence/map wait "
+			<< this->waitMs / this->frames << " ms/frame, frame " << averageFrameMs << " ms avg over " << this->frames << " frames" << endl;
+		cout << "  at " << targetFrameMs << " ms per frame the update kernel alone could move " << instancesPerSecond * targetFrameMs / 1000.0 / 1.0e6
+			<< " M instances" << endl;
+	}
+
+private:
+	// Instance buffer regions in flight when persistently mapped
+	static const GLuint REGION_COUNT = 3;
+
+	ThreadPool &pool;
+	GLuint count;
+
+	// Orbital parameters, one entry per rock
+	vector<float> radius;
+	vector<float> phase;
+	vector<float> angularVelocity;
+	// Height above the orbital plane is heightSin * sin(angle) + heightCos * cos(angle), an inclined circular orbit
+	vector<float> heightSin;
+	vector<float> heightCos;
+	vector<float> scale;
+	vector<float> spinAxisX;
+	vector<float> spinAxisY;
+	vector<float> spinAxisZ;
+	vector<float> spinRate;
+
+	GLuint VAO, VBO;
+	GLsizei rockVertexCount;
+
+	GLuint instanceVBO;
+	GLsizeiptr regionSize;
+	bool persistent;
+	AsteroidInstance *mapped;
+	GLsync fences[REGION_COUNT];
+	GLuint region;
+
+	GLuint frames;
+	double updateMs;
+	double waitMs;
+
+	// The kernel's split over the pool, [begin, end) ranges worked out once, so a frame's update allocates nothing
+	struct UpdateJob
+	{
+		GLuint begin, end;
+	};
+
+	vector<UpdateJob> jobs;
+	// What the jobs of the update in progress work on
+	float jobTime;
+	AsteroidInstance *jobDst;
+	// Jobs of the update in progress that haven't finished yet
+	GLuint jobsPending;
+	mutex jobMutex;
+	condition_variable jobsDone;
+
+	void generateOrbits(GLfloat innerRadius, GLfloat outerRadius, unsigned int seed)
+	{
+		mt19937 random(seed);
+		uniform_real_distribution<float> unit(0.0f, 1.0f);
+		normal_distribution<float> gaussian(0.0f, 1.0f);
+		const float twoPi = 6.28318530718f;
+
+		this->radius.resize(this->count);
+		this->phase.resize(this->count);
+		this->angularVelocity.resize(this->count);
+		this->heightSin.resize(this->count);
+		this->heightCos.resize(this->count);
+		this->scale.resize(this->count);
+		this->spinAxisX.resize(this->count);
+		this->spinAxisY.resize(this->count);
+		this->spinAxisZ.resize(this->count);
+		this->spinRate.resize(this->count);
+
+		for (GLuint i = 0; i < this->count; i++)
+		{
+			// Averaging two samples makes the belt densest in the middle
+			float r = innerRadius + (outerRadius - innerRadius) * 0.5f * (unit(random) + unit(random));
+			float inclination = min(0.05f, fabs(gaussian(random)) * 0.015f);
+			float node = twoPi * unit(random);
+			float size = unit(random);
+			glm::vec3 axis(gaussian(random), gaussian(random), gaussian(random));
+			axis = glm::normalize(axis);
+
+			this->radius[i] = r;
+			this->phase[i] = twoPi * unit(random);
+			// Kepler's third law, the inner edge moves faster than the outer one
+			this->angularVelocity[i] = 0.2f * pow(100.0f / r, 1.5f);
+			this->heightSin[i] = r * inclination * cos(node);
+			this->heightCos[i] = -r * inclination * sin(node);
+			// Mostly small rocks with the odd big one
+			this->scale[i] = 0.03f + 0.15f * size * size * size;
+			this->spinAxisX[i] = axis.x;
+			this->spinAxisY[i] = axis.y;
+			this->spinAxisZ[i] = axis.z;
+			this->spinRate[i] = 4.0f * unit(random) - 2.0f;
+		}
+	}
+
+	// A jittered icosahedron with flat normals, small enough to draw a million of
+	void setupRock(unsigned int seed)
+	{
+		const float t = 1.61803398875f;
+		glm::vec3 corners[12] =
+		{
+			glm::vec3(-1.0f, t, 0.0f), glm::vec3(1.0f, t, 0.0f), glm::vec3(-1.0f, -t, 0.0f), glm::vec3(1.0f, -t, 0.0f),
+			glm::vec3(0.0f, -1.0f, t), glm::vec3(0.0f, 1.0f, t), glm::vec3(0.0f, -1.0f, -t), glm::vec3(0.0f, 1.0f, -t),
+			glm::vec3(t, 0.0f, -1.0f), glm::vec3(t, 0.0f, 1.0f), glm::vec3(-t, 0.0f, -1.0f), glm::vec3(-t, 0.0f, 1.0f)
+		};
+		const GLuint faces[20][3] =
+		{
+			{ 0, 11, 5 }, { 0, 5, 1 }, { 0, 1, 7 }, { 0, 7, 10 }, { 0, 10, 11 },
+			{ 1, 5, 9 }, { 5, 11, 4 }, { 11, 10, 2 }, { 10, 7, 6 }, { 7, 1, 8 },
+			{ 3, 9, 4 }, { 3, 4, 2 }, { 3, 2, 6 }, { 3, 6, 8 }, { 3, 8, 9 },
+			{ 4, 9, 5 }, { 2, 4, 11 }, { 6, 2, 10 }, { 8, 6, 7 }, { 9, 8, 1 }
+		};
+
+		mt19937 random(seed);
+		uniform_real_distribution<float> jitter(0.7f, 1.1f);
+
+		for (GLuint i = 0; i < 12; i++)
+		{
+			corners[i] = glm::normalize(corners[i]) * jitter(random);
+		}
+
+		vector<Vertex> vertices;
+
+		for (GLuint i = 0; i < 20; i++)
+		{
+			glm::vec3 a = corners[faces[i][0]], b = corners[faces[i][1]], c = corners[faces[i][2]];
+			glm::vec3 normal = glm::normalize(glm::cross(b - a, c - a));
+
+			// The jitter never folds a face over, but keep the winding outward facing regardless
+			if (glm::dot(normal, a + b + c) < 0.0f)
+			{
+				swap(b, c);
+				normal = -normal;
+			}
+
+			glm::vec3 triangle[3] = { a, b, c };
+
+			for (GLuint j = 0; j < 3; j++)
+			{
+				Vertex vertex;
+				vertex.Position = triangle[j];
+				vertex.Normal = normal;
+				vertex.TexCoords = glm::vec2(0.0f, 0.0f);
+				vertices.push_back(vertex);
+			}
+		}
+
+		this->rockVertexCount = (GLsizei)vertices.size();
+
+		glGenVertexArrays(1, &this->VAO);
+		glGenBuffers(1, &this->VBO);
+
+		glBindVertexArray(this->VAO);
+		glBindBuffer(GL_ARRAY_BUFFER, this->VBO);
+		glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
+
+		// Vertex Positions
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid *)0);
+		// Vertex Normals
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid *)offsetof(Vertex, Normal));
+		// Per instance position/scale and spin, the pointers are set in Draw
+		glEnableVertexAttribArray(3);
+		glVertexAttribDivisor(3, 1);
+		glEnableVertexAttribArray(4);
+		glVertexAttribDivisor(4, 1);
+
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		glBindVertexArray(0);
+	}
+
+	// One job per pool thread, in chunks that keep the SIMD loop aligned to groups of four
+	void splitJobs()
+	{
+		GLuint threads = (GLuint)max<size_t>(1, this->pool.GetThreadCount());
+		GLuint chunk = ((this->count + threads - 1) / threads + 3) & ~3u;
+
+		for (GLuint begin = 0; begin < this->count; begin += chunk)
+		{
+			UpdateJob job;
+			job.begin = begin;
+			job.end = min(this->count, begin + chunk);
+			this->jobs.push_back(job);
+		}
+	}
+
+	// Runs the kernel on the pool and waits for all of it
+	void updateParallel(float time, AsteroidInstance *dst)
+	{
+		this->jobTime = time;
+		this->jobDst = dst;
+
+		{
+			unique_lock<mutex> lock(this->jobMutex);
+			this->jobsPending = (GLuint)this->jobs.size();
+		}
+
+		for (size_t i = 0; i < this->jobs.size(); i++)
+		{
+			const UpdateJob *job = &this->jobs[i];
+			this->pool.Post([this, job]() { this->runJob(*job); });
+		}
+
+		unique_lock<mutex> lock(this->jobMutex);
+		this->jobsDone.wait(lock, [this]() { return 0 == this->jobsPending; });
+	}
+
+	void runJob(const UpdateJob &job)
+	{
+		this->updateRange(job.begin, job.end, this->jobTime, this->jobDst);
+
+		unique_lock<mutex> lock(this->jobMutex);
+
+		if (0 == --this->jobsPending)
+		{
+			this->jobsDone.notify_one();
+		}
+	}
+
+	// Parabolic sine approximation (max error ~0.001), branch free so the scalar and SSE versions agree
+	static float fastSin(float x)
+	{
+		const float twoPi = 6.28318530718f, b = 1.27323954474f, c = -0.405284734569f;
+
+		// Wrap into [-pi, pi]
+		x -= twoPi * nearbyint(x * (1.0f / twoPi));
+
+		float y = b * x + c * x * fabs(x);
+
+		return 0.225f * (y * fabs(y) - y) + y;
+	}
+
+	void updateRange(GLuint begin, GLuint end, float time, AsteroidInstance *dst) const
+	{
+		GLuint i = begin;
+
+#ifdef ASTEROID_BELT_SSE
+		const __m128 t = _mm_set1_ps(time);
+		const __m128 twoPi = _mm_set1_ps(6.28318530718f), invTwoPi = _mm_set1_ps(1.0f / 6.28318530718f), halfPi = _mm_set1_ps(1.57079632679f);
+		const __m128 b = _mm_set1_ps(1.27323954474f), c = _mm_set1_ps(-0.405284734569f), p = _mm_set1_ps(0.225f);
+		const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+
+		// Same steps as fastSin, four lanes at a time
+		auto sin4 = [&](__m128 x)
+		{
+			x = _mm_sub_ps(x, _mm_mul_ps(twoPi, _mm_cvtepi32_ps(_mm_cvtps_epi32(_mm_mul_ps(x, invTwoPi)))));
+			__m128 y = _mm_add_ps(_mm_mul_ps(b, x), _mm_mul_ps(_mm_mul_ps(c, x), _mm_and_ps(x, absMask)));
+			return _mm_add_ps(_mm_mul_ps(p, _mm_sub_ps(_mm_mul_ps(y, _mm_and_ps(y, absMask)), y)), y);
+		};
+
+		for (; i + 4 <= end; i += 4)
+		{
+			__m128 r = _mm_loadu_ps(&this->radius[i]);
+			__m128 angle = _mm_add_ps(_mm_loadu_ps(&this->phase[i]), _mm_mul_ps(_mm_loadu_ps(&this->angularVelocity[i]), t));
+			__m128 s = sin4(angle);
+			__m128 co = sin4(_mm_add_ps(angle, halfPi));
+
+			__m128 x = _mm_mul_ps(r, co);
+			__m128 y = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&this->heightSin[i]), s), _mm_mul_ps(_mm_loadu_ps(&this->heightCos[i]), co));
+			__m128 z = _mm_mul_ps(r, s);
+			__m128 w = _mm_loadu_ps(&this->scale[i]);
+
+			__m128 ax = _mm_loadu_ps(&this->spinAxisX[i]);
+			__m128 ay = _mm_loadu_ps(&this->spinAxisY[i]);
+			__m128 az = _mm_loadu_ps(&this->spinAxisZ[i]);
+			__m128 spin = _mm_mul_ps(_mm_loadu_ps(&this->spinRate[i]), t);
+
+			// Structure of arrays to the interleaved instance layout
+			_MM_TRANSPOSE4_PS(x, y, z, w);
+			_MM_TRANSPOSE4_PS(ax, ay, az, spin);
+
+			float *out = (float *)&dst[i];
+			_mm_storeu_ps(out + 0, x);
+			_mm_storeu_ps(out + 4, ax);
+			_mm_storeu_ps(out + 8, y);
+			_mm_storeu_ps(out + 12, ay);
+			_mm_storeu_ps(out + 16, z);
+			_mm_storeu_ps(out + 20, az);
+			_mm_storeu_ps(out + 24, w);
+			_mm_storeu_ps(out + 28, spin);
+		}
+#endif
+
+		for (; i < end; i++)
+		{
+			float angle = this->phase[i] + this->angularVelocity[i] * time;
+			float s = fastSin(angle);
+			float co = fastSin(angle + 1.57079632679f);
+
+			dst[i].positionScale = glm::vec4(this->radius[i] * co, this->heightSin[i] * s + this->heightCos[i] * co, this->radius[i] * s, this->scale[i]);
+			dst[i].spin = glm::vec4(this->spinAxisX[i], this->spinAxisY[i], this->spinAxisZ[i], this->spinRate[i] * time);
+		}
+	}
+
+	AsteroidBelt(const AsteroidBelt &);
+	AsteroidBelt &operator=(const AsteroidBelt &);
+};
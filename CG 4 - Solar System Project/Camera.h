@@ -24,14 +24,21 @@ const GLfloat PITCH = 0.0f;
 const GLfloat SPEED = 6.0f;
 const GLfloat SENSITIVTY = 0.25f;
 const GLfloat ZOOM = 45.0f;
+const GLfloat NEAR_PLANE = 0.1f;
 
 
-// An abstract camera class that processes input and calculates the corresponding Eular Angles, Vectors and Matrices for use in OpenGL
+// An abstract camera class that processes input and calculates the corresponding Eular Angles, Vectors and Matrices for use in OpenGL.
+// The position is kept in double precision and everything is drawn relative to it: the view matrix only rotates, and
+// world transforms (built in double) have the camera position taken off their translation before they are rounded
+// to float (GetRelativeTransform). Whatever is near the camera keeps full float precision however far from the origin
+// the two are, at no cost on the GPU.
+// The view, projection and their product are cached, and only recomputed after something they depend on changed: the
+// orientation for the view (the position doesn't enter it), the zoom, aspect ratio or depth mode for the projection.
 class Camera
 {
 public:
 	// Constructor with vectors
-	Camera(glm::vec3 position = glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3 up = glm::vec3(0.0f, 1.0f, 0.0f), GLfloat yaw = YAW, GLfloat pitch = PITCH) : front(glm::vec3(0.0f, 0.0f, -1.0f)), movementSpeed(SPEED), mouseSensitivity(SENSITIVTY), zoom(ZOOM)
+	Camera(glm::dvec3 position = glm::dvec3(0.0, 0.0, 0.0), glm::vec3 up = glm::vec3(0.0f, 1.0f, 0.0f), GLfloat yaw = YAW, GLfloat pitch = PITCH) : front(glm::vec3(0.0f, 0.0f, -1.0f)), movementSpeed(SPEED), mouseSensitivity(SENSITIVTY), zoom(ZOOM), reverseZ(false), aspect(1.0f), viewDirty(true), projectionDirty(true)
 	{
 		this->position = position;
 		this->worldUp = up;
@@ -41,44 +48,105 @@ public:
 	}
 
 	// Constructor with scalar values
-	Camera(GLfloat posX, GLfloat posY, GLfloat posZ, GLfloat upX, GLfloat upY, GLfloat upZ, GLfloat yaw, GLfloat pitch) : front(glm::vec3(0.0f, 0.0f, -1.0f)), movementSpeed(SPEED), mouseSensitivity(SENSITIVTY), zoom(ZOOM)
+	Camera(GLfloat posX, GLfloat posY, GLfloat posZ, GLfloat upX, GLfloat upY, GLfloat upZ, GLfloat yaw, GLfloat pitch) : front(glm::vec3(0.0f, 0.0f, -1.0f)), movementSpeed(SPEED), mouseSensitivity(SENSITIVTY), zoom(ZOOM), reverseZ(false), aspect(1.0f), viewDirty(true), projectionDirty(true)
 	{
-		this->position = glm::vec3(posX, posY, posZ);
+		this->position = glm::dvec3(posX, posY, posZ);
 		this->worldUp = glm::vec3(upX, upY, upZ);
 		this->yaw = yaw;
 		this->pitch = pitch;
 		this->updateCameraVectors();
 	}
 
-	// Returns the view matrix calculated using Eular Angles and the LookAt Matrix
-	glm::mat4 GetViewMatrix()
+	// Returns the view matrix calculated using Eular Angles and the LookAt Matrix. The camera sits at the origin, so
+	// it is meant for transforms from GetRelativeTransform.
+	const glm::mat4 &GetViewMatrix()
 	{
-		return glm::lookAt(this->position, this->position + this->front, this->up);
+		this->updateMatrices();
+		return this->view;
+	}
+
+	// Projection times view, for shaders that don't need the two separately
+	const glm::mat4 &GetViewProjectionMatrix()
+	{
+		this->updateMatrices();
+		return this->viewProjection;
+	}
+
+	// Perspective projection with the far plane at infinity, so nothing in the scene is ever clipped by distance.
+	//  - Reverse-Z: depth runs from 1 at the near plane to 0 at infinity, for a [0, 1] clip range (glClipControl
+	//    GL_ZERO_TO_ONE) and a GL_GREATER depth test. With a float depth buffer the precision is then about the same
+	//    relative to the distance everywhere, instead of almost all of it being spent right in front of the camera.
+	//  - Otherwise the usual GL mapping, -1 at the near plane and 1 at infinity.
+	const glm::mat4 &GetProjectionMatrix()
+	{
+		this->updateMatrices();
+		return this->projection;
+	}
+
+	// Width over height of the framebuffer, call it whenever that is resized
+	void SetAspectRatio(GLfloat aspect)
+	{
+		if (aspect != this->aspect)
+		{
+			this->aspect = aspect;
+			this->projectionDirty = true;
+		}
+	}
+
+	// Selects the reverse-Z projection, the depth state has to be set up to match (see main.cpp)
+	void SetReverseZ(bool reverseZ)
+	{
+		if (reverseZ != this->reverseZ)
+		{
+			this->reverseZ = reverseZ;
+			this->projectionDirty = true;
+		}
+	}
+
+	bool IsReverseZ() const
+	{
+		return this->reverseZ;
+	}
+
+	// A world transform made relative to the camera. The camera position is subtracted from the translation in double
+	// precision, only the (small) difference is rounded to float.
+	glm::mat4 GetRelativeTransform(const glm::dmat4 &world) const
+	{
+		glm::dmat4 relative = world;
+		relative[3] = world[3] - glm::dvec4(this->position, 0.0);
+
+		return glm::mat4(relative);
+	}
+
+	// A world position relative to the camera, e.g. for light positions
+	glm::vec3 GetRelativePosition(const glm::dvec3 &world) const
+	{
+		return glm::vec3(world - this->position);
 	}
 
 	// Processes input received from any keyboard-like input system. Accepts input parameter in the form of camera defined ENUM (to abstract it from windowing systems)
 	void ProcessKeyboard(Camera_Movement direction, GLfloat deltaTime)
 	{
-		GLfloat velocity = this->movementSpeed * deltaTime;
+		GLdouble velocity = this->movementSpeed * deltaTime;
 
 		if (direction == FORWARD)
 		{
-			this->position += this->front * velocity;
+			this->position += glm::dvec3(this->front) * velocity;
 		}
 
 		if (direction == BACKWARD)
 		{
-			this->position -= this->front * velocity;
+			this->position -= glm::dvec3(this->front) * velocity;
 		}
 
 		if (direction == LEFT)
 		{
-			this->position -= this->right * velocity;
+			this->position -= glm::dvec3(this->right) * velocity;
 		}
 
 		if (direction == RIGHT)
 		{
-			this->position += this->right * velocity;
+			this->position += glm::dvec3(this->right) * velocity;
 		}
 	}
 
@@ -112,6 +180,8 @@ public:
 	// Processes input received from a mouse scroll-wheel event. Only requires input on the vertical wheel-axis
 	void ProcessMouseScroll(GLfloat yOffset)
 	{
+		GLfloat previousZoom = this->zoom;
+
 		if (this->zoom >= 1.0f && this->zoom <= 45.0f)
 		{
 			this->zoom -= yOffset;
@@ -126,6 +196,11 @@ public:
 		{
 			this->zoom = 45.0f;
 		}
+
+		if (this->zoom != previousZoom)
+		{
+			this->projectionDirty = true;
+		}
 	}
 
 	GLfloat GetZoom()
@@ -133,14 +208,15 @@ public:
 		return this->zoom;
 	}
 
-	glm::vec3 GetPosition()
+	// World position, in double precision
+	glm::dvec3 GetPosition()
 	{
 		return this->position;
 	}
 
 private:
 	// Camera Attributes
-	glm::vec3 position;
+	glm::dvec3 position;
 	glm::vec3 front;
 	glm::vec3 up;
 	glm::vec3 right;
@@ -154,6 +230,53 @@ private:
 	GLfloat movementSpeed;
 	GLfloat mouseSensitivity;
 	GLfloat zoom;
+	bool reverseZ;
+	GLfloat aspect;
+
+	// Cached matrices, see updateMatrices
+	glm::mat4 view;
+	glm::mat4 projection;
+	glm::mat4 viewProjection;
+	bool viewDirty;
+	bool projectionDirty;
+
+	// Recomputes whichever cached matrices are out of date
+	void updateMatrices()
+	{
+		if (!this->viewDirty && !this->projectionDirty)
+		{
+			return;
+		}
+
+		if (this->viewDirty)
+		{
+			this->view = glm::lookAt(glm::vec3(0.0f), this->front, this->up);
+		}
+
+		if (this->projectionDirty)
+		{
+			GLfloat focal = 1.0f / tan(glm::radians(this->zoom) * 0.5f);
+
+			this->projection = glm::mat4(0.0f);
+			this->projection[0][0] = focal / this->aspect;
+			this->projection[1][1] = focal;
+			this->projection[2][3] = -1.0f;
+
+			if (this->reverseZ)
+			{
+				this->projection[3][2] = NEAR_PLANE;
+			}
+			else
+			{
+				this->projection[2][2] = -1.0f;
+				this->projection[3][2] = -2.0f * NEAR_PLANE;
+			}
+		}
+
+		this->viewProjection = this->projection * this->view;
+		this->viewDirty = false;
+		this->projectionDirty = false;
+	}
 
 	// Calculates the front vector from the Camera's (updated) Eular Angles
 	void updateCameraVectors()
@@ -167,5 +290,6 @@ private:
 		// Also re-calculate the Right and Up vector
 		this->right = glm::normalize(glm::cross(this->front, this->worldUp));  // Normalize the vectors, because their length gets closer to 0 the more you look up or down which results in slower movement.
 		this->up = glm::normalize(glm::cross(this->right, this->front));
+		this->viewDirty = true;
 	}
 };
\ No newline at end of file
@@ -0,0 +1,210 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+
+#include <GL/glew.h>
+
+#include "Vertex.h"
+#include "InstanceBuffer.h"
+
+using namespace std;
+
+// Where a mesh lives inside a GeometryArena
+struct GeometryRange
+{
+	// Added to every index of the mesh, i.e. the position of its first vertex in the shared vertex buffer
+	GLint baseVertex;
+	// Position of its first index in the shared index buffer
+	GLuint firstIndex;
+	GLsizei indexCount;
+
+	// Byte offset of the first index, as glDrawElements* expects it
+	const GLvoid *GetIndexOffset() const
+	{
+		return (const GLvoid *)(this->firstIndex * sizeof(GLuint));
+	}
+};
+
+// One vertex buffer, one index buffer and one VAO shared by many meshes. Meshes are appended to the buffers and keep
+// their original (zero based) indices, drawing them only needs the shared VAO and glDrawElementsBaseVertex. So
+// consecutive meshes, even from different models, never switch VAOs, and their draws can be batched together.
+// When an allocation doesn't fit, both buffers grow and the old contents are copied over on the GPU.
+// Instanced draws go through a second VAO over the same buffers, so the per-instance attributes (which advance per
+// instance) never stay enabled on the VAO the multi-draw uses, where baseInstance would index past their buffer.
+class GeometryArena
+{
+public:
+	GeometryArena(GLsizei vertexCapacity = 1 << 18, GLsizei indexCapacity = 1 << 20)
+		: vertexCount(0), indexCount(0), vertexCapacity(0), indexCapacity(0), instanceVBO(0)
+	{
+		glGenVertexArrays(1, &this->VAO);
+		glGenVertexArrays(1, &this->instancedVAO);
+		this->VBO = 0;
+		this->EBO = 0;
+		this->reserve(vertexCapacity, indexCapacity);
+	}
+
+	~GeometryArena()
+	{
+		glDeleteVertexArrays(1, &this->VAO);
+		glDeleteVertexArrays(1, &this->instancedVAO);
+		glDeleteBuffers(1, &this->VBO);
+		glDeleteBuffers(1, &this->EBO);
+	}
+
+	// Copies a mesh into the arena and returns where it ended up
+	GeometryRange Allocate(const vector<Vertex> &vertices, const vector<GLuint> &indices)
+	{
+		GLsizei newVertices = (GLsizei)vertices.size();
+		GLsizei newIndices = (GLsizei)indices.size();
+
+		if (this->vertexCount + newVertices > this->vertexCapacity || this->indexCount + newIndices > this->indexCapacity)
+		{
+			// Grow geometrically so a long run of small allocations doesn't copy the arena over and over
+			this->reserve(max(this->vertexCapacity * 2, this->vertexCount + newVertices), max(this->indexCapacity * 2, this->indexCount + newIndices));
+		}
+
+		GeometryRange range;
+		range.baseVertex = this->vertexCount;
+		range.firstIndex = this->indexCount;
+		range.indexCount = newIndices;
+
+		glBindBuffer(GL_ARRAY_BUFFER, this->VBO);
+		glBufferSubData(GL_ARRAY_BUFFER, this->vertexCount * sizeof(Vertex), newVertices * sizeof(Vertex), vertices.data());
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+		// The element buffer binding is VAO state, go through the VAO rather than disturb whatever is bound
+		glBindVertexArray(this->VAO);
+		glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, this->indexCount * sizeof(GLuint), newIndices * sizeof(GLuint), indices.data());
+		glBindVertexArray(0);
+
+		this->vertexCount += newVertices;
+		this->indexCount += newIndices;
+
+		return range;
+	}
+
+	// Binds the shared VAO, every mesh in the arena draws from it
+	void Bind() const
+	{
+		glBindVertexArray(this->VAO);
+	}
+
+	void Draw(const GeometryRange &range) const
+	{
+		glDrawElementsBaseVertex(GL_TRIANGLES, range.indexCount, GL_UNSIGNED_INT, range.GetIndexOffset(), range.baseVertex);
+	}
+
+	void DrawInstanced(const GeometryRange &range, GLsizei instanceCount) const
+	{
+		glDrawElementsInstancedBaseVertex(GL_TRIANGLES, range.indexCount, GL_UNSIGNED_INT, range.GetIndexOffset(), instanceCount, range.baseVertex);
+	}
+
+	// Binds the instanced VAO and points its instance attributes at the given buffer, unless they already are
+	void BindInstanced(const InstanceBuffer &instances)
+	{
+		glBindVertexArray(this->instancedVAO);
+
+		if (this->instanceVBO != instances.GetID())
+		{
+			instances.BindAttributes();
+			this->instanceVBO = instances.GetID();
+		}
+	}
+
+	GLuint GetVAO() const
+	{
+		return this->VAO;
+	}
+
+	GLuint GetVBO() const
+	{
+		return this->VBO;
+	}
+
+	GLuint GetEBO() const
+	{
+		return this->EBO;
+	}
+
+	GLsizei GetVertexCount() const
+	{
+		return this->vertexCount;
+	}
+
+	GLsizei GetIndexCount() const
+	{
+		return this->indexCount;
+	}
+
+private:
+	GLuint VAO, instancedVAO, VBO, EBO;
+	GLsizei vertexCount, indexCount;
+	GLsizei vertexCapacity, indexCapacity;
+	// Instance buffer the instanced VAO's instance attributes point at, 0 if none
+	GLuint instanceVBO;
+
+	// (Re)creates both buffers with the given capacity, keeping the current contents, and rebuilds both VAOs around them
+	void reserve(GLsizei vertexCapacity, GLsizei indexCapacity)
+	{
+		GLuint buffers[2];
+		glGenBuffers(2, buffers);
+
+		glBindBuffer(GL_COPY_WRITE_BUFFER, buffers[0]);
+		glBufferData(GL_COPY_WRITE_BUFFER, vertexCapacity * sizeof(Vertex), NULL, GL_STATIC_DRAW);
+
+		if (this->VBO)
+		{
+			glBindBuffer(GL_COPY_READ_BUFFER, this->VBO);
+			glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, this->vertexCount * sizeof(Vertex));
+			glDeleteBuffers(1, &this->VBO);
+		}
+
+		glBindBuffer(GL_COPY_WRITE_BUFFER, buffers[1]);
+		glBufferData(GL_COPY_WRITE_BUFFER, indexCapacity * sizeof(GLuint), NULL, GL_STATIC_DRAW);
+
+		if (this->EBO)
+		{
+			glBindBuffer(GL_COPY_READ_BUFFER, this->EBO);
+			glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, this->indexCount * sizeof(GLuint));
+			glDeleteBuffers(1, &this->EBO);
+		}
+
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+		this->VBO = buffers[0];
+		this->EBO = buffers[1];
+		this->vertexCapacity = vertexCapacity;
+		this->indexCapacity = indexCapacity;
+
+		this->attachBuffers(this->VAO);
+		this->attachBuffers(this->instancedVAO);
+	}
+
+	// Points a VAO's element buffer and per-vertex attributes at the current buffers
+	void attachBuffers(GLuint vertexArray)
+	{
+		glBindVertexArray(vertexArray);
+		glBindBuffer(GL_ARRAY_BUFFER, this->VBO);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->EBO);
+
+		// Set the vertex attribute pointers
+		// Vertex Positions
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid *)0);
+		// Vertex Normals
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid *)offsetof(Vertex, Normal));
+		// Vertex Texture Coords
+		glEnableVertexAttribArray(2);
+		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid *)offsetof(Vertex, TexCoords));
+
+		glBindVertexArray(0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	GeometryArena(const GeometryArena &);
+	GeometryArena &operator=(const GeometryArena &);
+};
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <string>
+#include <memory>
+#include <algorithm>
+
+#include "SOIL2/SOIL2.h"
+
+using namespace std;
+
+// Pixels decoded by SOIL (always RGB, 3 bytes per pixel), freed when the last owner goes away.
+// Decoding is plain CPU work, so it can happen on any thread; only the upload needs the GL context.
+struct ImageData
+{
+	int width = 0;
+	int height = 0;
+	shared_ptr<unsigned char> pixels;
+};
+
+ImageData LoadImageData(const char *path, string directory)
+{
+	string filename = string(path);
+	filename = directory + '/' + filename;
+
+	ImageData image;
+	unsigned char *pixels = SOIL_load_image(filename.c_str(), &image.width, &image.height, 0, SOIL_LOAD_RGB);
+	image.pixels = shared_ptr<unsigned char>(pixels, SOIL_free_image_data);
+
+	return image;
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <vector>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_inverse.hpp>
+
+using namespace std;
+
+// First vertex attribute location used by the per-instance data, after position, normal and texture coordinates.
+// The model matrix takes locations 3-6 (one per column) and the normal matrix 7-9.
+const GLuint INSTANCE_ATTRIBUTE_LOCATION = 3;
+
+// Per-instance data read by the instanced vertex shaders, one entry per drawn copy
+struct InstanceData
+{
+	glm::mat4 model;
+	glm::mat3 normalMatrix;
+
+	InstanceData() {}
+
+	InstanceData(const glm::mat4 &model) : model(model), normalMatrix(glm::inverseTranspose(glm::mat3(model))) {}
+};
+
+// Vertex buffer of InstanceData, fed to Mesh::DrawInstanced/Model::DrawInstanced as instanced vertex attributes
+class InstanceBuffer
+{
+public:
+	InstanceBuffer() : count(0), capacity(0)
+	{
+		glGenBuffers(1, &this->VBO);
+	}
+
+	~InstanceBuffer()
+	{
+		glDeleteBuffers(1, &this->VBO);
+	}
+
+	// Replaces the contents with new instances, typically once per frame. The storage is orphaned first so the
+	// driver never has to wait for draws still reading last frame's data.
+	void Update(const InstanceData *instances, GLsizei instanceCount)
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, this->VBO);
+
+		if (instanceCount > this->capacity)
+		{
+			this->capacity = instanceCount;
+		}
+
+		glBufferData(GL_ARRAY_BUFFER, this->capacity * sizeof(InstanceData), NULL, GL_STREAM_DRAW);
+
+		if (instanceCount > 0)
+		{
+			glBufferSubData(GL_ARRAY_BUFFER, 0, instanceCount * sizeof(InstanceData), instances);
+		}
+
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		this->count = instanceCount;
+	}
+
+	void Update(const vector<InstanceData> &instances)
+	{
+		this->Update(instances.empty() ? NULL : &instances[0], (GLsizei)instances.size());
+	}
+
+	GLsizei GetCount() const
+	{
+		return this->count;
+	}
+
+	// Points the instance attributes of the currently bound VAO at this buffer, advancing once per instance
+	void BindAttributes() const
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, this->VBO);
+
+		for (GLuint i = 0; i < 4; i++)
+		{
+			GLuint location = INSTANCE_ATTRIBUTE_LOCATION + i;
+			glEnableVertexAttribArray(location);
+			glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (GLvoid *)(offsetof(InstanceData, model) + i * sizeof(glm::vec4)));
+			glVertexAttribDivisor(location, 1);
+		}
+
+		for (GLuint i = 0; i < 3; i++)
+		{
+			GLuint location = INSTANCE_ATTRIBUTE_LOCATION + 4 + i;
+			glEnableVertexAttribArray(location);
+			glVertexAttribPointer(location, 3, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (GLvoid *)(offsetof(InstanceData, normalMatrix) + i * sizeof(glm::vec3)));
+			glVertexAttribDivisor(location, 1);
+		}
+
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	GLuint GetID() const
+	{
+		return this->VBO;
+	}
+
+private:
+	GLuint VBO;
+	GLsizei count;
+	GLsizei capacity;
+
+	InstanceBuffer(const InstanceBuffer &);
+	InstanceBuffer &operator=(const InstanceBuffer &);
+};
@@ -0,0 +1,406 @@
+#pragma once
+
+#include <vector>
+#include <map>
+#include <iostream>
+#include <algorithm>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "Model.h"
+
+using namespace std;
+
+// Where a material's diffuse texture ended up in the packed array
+struct MaterialSlot
+{
+	// Array layer, -1 if the material isn't packed
+	GLint layer;
+	// Scale (xy) and offset (zw) taking the mesh's texture coordinates into its region of the layer
+	glm::vec4 uvTransform;
+};
+
+// Copies the diffuse textures of a set of materials into one GL_TEXTURE_2D_ARRAY, so draws with different materials
+// can share a single texture binding (see SceneRenderer::SetMaterials).
+//  - The most common texture size becomes the layer size, and textures of that size get a layer each.
+//  - Other sizes go into atlas layers. An atlas layer is cut into a grid of equal slots, one slot size per layer,
+//    and the material's texture coordinates are scaled and offset into its slot. A texture bigger than a layer
+//    is packed from the first of its mip levels that fits.
+//  - The copies are made on the GPU with glCopyImageSubData (GL 4.3), level by level, from the finished textures.
+//    Pack therefore has to wait until streaming is done, and all textures need the same internal format (all BC1
+//    or all RGB8). Slot sizes have to divide the layer size, which any smaller power of two does.
+// The source textures are left alone, the other render paths still bind them.
+class MaterialPacker
+{
+public:
+	MaterialPacker() : texture(0), width(0), height(0), layerCount(0), atlasLayerCount(0), levelCount(0), bytes(0) {}
+
+	~MaterialPacker()
+	{
+		glDeleteTextures(1, &this->texture);
+	}
+
+	static bool IsSupported()
+	{
+		return GL_FALSE != GLEW_VERSION_4_3;
+	}
+
+	// Registers the material of every mesh of the model, nothing is copied until Pack
+	void Add(Model &model)
+	{
+		vector<Mesh> &meshes = model.GetMeshes();
+
+		for (GLuint i = 0; i < meshes.size(); i++)
+		{
+			GLuint diffuse = meshes[i].GetDiffuseTexture();
+
+			if (diffuse)
+			{
+				this->materials[meshes[i].GetMaterialID()] = diffuse;
+			}
+		}
+	}
+
+	// Builds the array from the registered materials, once. Every texture has to be complete by now. Returns false,
+	// and leaves nothing behind, if they can't all be packed.
+	bool Pack()
+	{
+		if (this->texture || this->materials.empty())
+		{
+			return false;
+		}
+
+		// Each texture once, materials may share one
+		vector<Source> sources;
+		map<GLuint, size_t> sourceIndices;
+
+		for (map<GLuint, GLuint>::iterator material = this->materials.begin(); material != this->materials.end(); material++)
+		{
+			if (sourceIndices.count(material->second))
+			{
+				continue;
+			}
+
+			Source source = Describe(material->second);
+
+			if (0 == source.width || 0 == source.height)
+			{
+				cout << "MaterialPacker: texture " << material->second << " isn't loaded" << endl;
+				return false;
+			}
+
+			if (!sources.empty() && source.format != sources[0].format)
+			{
+				cout << "MaterialPacker: textures have different formats" << endl;
+				return false;
+			}
+
+			sourceIndices[material->second] = sources.size();
+			sources.push_back(source);
+		}
+
+		// The most common size is the layer size, the bigger one on a tie
+		map<pair<GLint, GLint>, GLuint> sizes;
+		GLuint best = 0;
+
+		for (size_t i = 0; i < sources.size(); i++)
+		{
+			GLuint count = ++sizes[make_pair(sources[i].width, sources[i].height)];
+
+			if (count > best || (count == best && sources[i].width * sources[i].height > this->width * this->height))
+			{
+				best = count;
+				this->width = sources[i].width;
+				this->height = sources[i].height;
+			}
+		}
+
+		bool compressed = sources[0].compressed;
+		// Atlas layers being filled, by slot size: the layer and its next free slot
+		map<pair<GLint, GLint>, pair<GLint, GLint>> atlases;
+
+		for (size_t i = 0; i < sources.size(); i++)
+		{
+			Source &source = sources[i];
+
+			if (!this->place(source, compressed, atlases))
+			{
+				cout << "MaterialPacker: can't fit a " << source.width << "x" << source.height << " texture into " << this->width << "x" << this->height
+					<< " layers" << endl;
+				this->width = this->height = this->layerCount = this->atlasLayerCount = 0;
+				return false;
+			}
+		}
+
+		// The whole chain down to 1x1, unless an atlas slot runs out of levels sooner (see copy)
+		this->levelCount = 1;
+
+		while ((max(this->width, this->height) >> this->levelCount) > 0)
+		{
+			this->levelCount++;
+		}
+
+		glGenTextures(1, &this->texture);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, this->texture);
+		glTexStorage3D(GL_TEXTURE_2D_ARRAY, this->levelCount, GetStorageFormat(sources[0].format), this->width, this->height, this->layerCount);
+
+		GLint deepestLevel = this->levelCount - 1;
+
+		for (size_t i = 0; i < sources.size(); i++)
+		{
+			deepestLevel = min(deepestLevel, this->copy(sources[i], compressed));
+		}
+
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BASE_LEVEL, 0);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, deepestLevel);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+		this->bytes = 0;
+
+		for (GLint level = 0; level <= deepestLevel; level++)
+		{
+			GLint levelWidth = max(1, this->width >> level);
+			GLint levelHeight = max(1, this->height >> level);
+
+			this->bytes += compressed ? (size_t)((levelWidth + 3) / 4) * ((levelHeight + 3) / 4) * 8 * this->layerCount
+				: (size_t)levelWidth * levelHeight * GetTexelBytes(sources[0].format) * this->layerCount;
+		}
+
+		glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+		// Slots are indexed by material ID, which are small and consecutive
+		this->slots.assign(this->materials.rbegin()->first + 1, GetUnpackedSlot());
+
+		for (map<GLuint, GLuint>::iterator material = this->materials.begin(); material != this->materials.end(); material++)
+		{
+			const Source &source = sources[sourceIndices[material->second]];
+			MaterialSlot &slot = this->slots[material->first];
+
+			slot.layer = source.layer;
+			slot.uvTransform = glm::vec4((GLfloat)source.slotWidth / this->width, (GLfloat)source.slotHeight / this->height,
+				(GLfloat)source.x / this->width, (GLfloat)source.y / this->height);
+		}
+
+		return true;
+	}
+
+	bool IsPacked() const
+	{
+		return 0 != this->texture;
+	}
+
+	// The GL_TEXTURE_2D_ARRAY, 0 until Pack succeeded
+	GLuint GetTexture() const
+	{
+		return this->texture;
+	}
+
+	// Where the material's texture is, GetUnpackedSlot() if it wasn't registered
+	const MaterialSlot &GetSlot(GLuint material) const
+	{
+		return material < this->slots.size() ? this->slots[material] : GetUnpackedSlot();
+	}
+
+	// Layer -1 and texture coordinates left as they are
+	static const MaterialSlot &GetUnpackedSlot()
+	{
+		static const MaterialSlot unpacked = { -1, glm::vec4(1.0f, 1.0f, 0.0f, 0.0f) };
+		return unpacked;
+	}
+
+	GLuint GetMaterialCount() const
+	{
+		return (GLuint)this->materials.size();
+	}
+
+	GLint GetWidth() const
+	{
+		return this->width;
+	}
+
+	GLint GetHeight() const
+	{
+		return this->height;
+	}
+
+	// Layers in total, and how many of them are atlases
+	GLint GetLayerCount() const
+	{
+		return this->layerCount;
+	}
+
+	GLint GetAtlasLayerCount() const
+	{
+		return this->atlasLayerCount;
+	}
+
+	// Video memory taken by the array
+	size_t GetBytes() const
+	{
+		return this->bytes;
+	}
+
+private:
+	// A texture to pack and where it goes
+	struct Source
+	{
+		GLuint texture;
+		GLint width, height;
+		GLint levels;
+		GLenum format;
+		bool compressed;
+		// First mip level copied, its size and position in the layer
+		GLint level;
+		GLint slotWidth, slotHeight;
+		GLint layer, x, y;
+	};
+
+	// Material ID to diffuse texture
+	map<GLuint, GLuint> materials;
+	vector<MaterialSlot> slots;
+
+	GLuint texture;
+	GLint width, height;
+	GLint layerCount, atlasLayerCount;
+	GLint levelCount;
+	size_t bytes;
+
+	// Size, format and mip levels of a finished 2D texture
+	static Source Describe(GLuint texture)
+	{
+		Source source = Source();
+		GLint compressed = GL_FALSE;
+		GLint format = 0;
+
+		source.texture = texture;
+
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &source.width);
+		glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &source.height);
+		glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_INTERNAL_FORMAT, &format);
+		glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_COMPRESSED, &compressed);
+
+		// Levels that were never specified report a width of 0
+		for (source.levels = 1; source.levels < 32; source.levels++)
+		{
+			GLint levelWidth = 0;
+			glGetTexLevelParameteriv(GL_TEXTURE_2D, source.levels, GL_TEXTURE_WIDTH, &levelWidth);
+
+			if (0 == levelWidth)
+			{
+				break;
+			}
+		}
+
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		source.format = (GLenum)format;
+		source.compressed = GL_FALSE != compressed;
+
+		return source;
+	}
+
+	// glTexStorage3D wants a sized format, textures uploaded as plain GL_RGB may report the unsized one
+	static GLenum GetStorageFormat(GLenum format)
+	{
+		switch (format)
+		{
+		case GL_RGB:
+			return GL_RGB8;
+		case GL_RGBA:
+			return GL_RGBA8;
+		default:
+			return format;
+		}
+	}
+
+	static GLint GetTexelBytes(GLenum format)
+	{
+		return (GL_RGBA == format || GL_RGBA8 == format) ? 4 : 3;
+	}
+
+	// Gives the source a whole layer or a slot in an atlas layer
+	bool place(Source &source, bool compressed, map<pair<GLint, GLint>, pair<GLint, GLint>> &atlases)
+	{
+		// The first mip level that fits and divides the layer evenly
+		for (source.level = 0; source.level < source.levels; source.level++)
+		{
+			source.slotWidth = max(1, source.width >> source.level);
+			source.slotHeight = max(1, source.height >> source.level);
+
+			if (source.slotWidth <= this->width && source.slotHeight <= this->height && 0 == this->width % source.slotWidth &&
+				0 == this->height % source.slotHeight)
+			{
+				break;
+			}
+		}
+
+		if (source.level == source.levels)
+		{
+			return false;
+		}
+
+		if (source.slotWidth == this->width && source.slotHeight == this->height)
+		{
+			source.layer = this->layerCount++;
+			source.x = source.y = 0;
+			return true;
+		}
+
+		// Compressed copies have to start on a 4x4 block
+		if (compressed && (source.slotWidth % 4 || source.slotHeight % 4))
+		{
+			return false;
+		}
+
+		GLint columns = this->width / source.slotWidth;
+		GLint slotCount = columns * (this->height / source.slotHeight);
+		// A size seen for the first time starts out as a full atlas, so it gets a layer of its own below
+		pair<GLint, GLint> &atlas = atlases.insert(make_pair(make_pair(source.slotWidth, source.slotHeight), make_pair(-1, slotCount))).first->second;
+
+		if (atlas.second == slotCount)
+		{
+			atlas = make_pair(this->layerCount++, 0);
+			this->atlasLayerCount++;
+		}
+
+		GLint slot = atlas.second++;
+
+		source.layer = atlas.first;
+		source.x = (slot % columns) * source.slotWidth;
+		source.y = (slot / columns) * source.slotHeight;
+
+		return true;
+	}
+
+	// Copies the source's levels into the bound array, returns the last array level it filled. A slot runs out of
+	// levels before the layer does: once it is below a texel, or for compressed formats below a block.
+	GLint copy(const Source &source, bool compressed)
+	{
+		GLint level = 0;
+
+		for (; level < this->levelCount && source.level + level < source.levels; level++)
+		{
+			bool whole = source.slotWidth == this->width && source.slotHeight == this->height;
+			GLint copyWidth = whole ? max(1, source.slotWidth >> level) : source.slotWidth >> level;
+			GLint copyHeight = whole ? max(1, source.slotHeight >> level) : source.slotHeight >> level;
+
+			if (0 == copyWidth || 0 == copyHeight || (!whole && compressed && (copyWidth % 4 || copyHeight % 4)))
+			{
+				break;
+			}
+
+			glCopyImageSubData(source.texture, GL_TEXTURE_2D, source.level + level, 0, 0, 0, this->texture, GL_TEXTURE_2D_ARRAY, level,
+				source.x >> level, source.y >> level, source.layer, copyWidth, copyHeight, 1);
+		}
+
+		return level - 1;
+	}
+
+	MaterialPacker(const MaterialPacker &);
+	MaterialPacker &operator=(const MaterialPacker &);
+};
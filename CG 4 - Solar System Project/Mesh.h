@@ -5,63 +5,308 @@
 #include <sstream>
 #include <iostream>
 #include <vector>
+#include <map>
 
 #include <GL/glew.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+#include "Vertex.h"
+#include "InstanceBuffer.h"
+#include "GeometryArena.h"
+#include "StateTracker.h"
+
 using namespace std;
 
-struct Vertex
+// What a mesh keeps in system memory once its geometry has been uploaded
+enum MeshResidency
 {
-	// Position
-	glm::vec3 Position;
-	// Normal
-	glm::vec3 Normal;
-	// TexCoords
-	glm::vec2 TexCoords;
+	// vertices and indices stay as they are
+	RESIDENCY_KEEP,
+	// Both are released, the geometry only lives on the GPU
+	RESIDENCY_DISCARD,
+	// Only positions and indices are kept, e.g. for picking or collision (12 instead of 32 bytes per vertex)
+	RESIDENCY_COMPACT
 };
 
 struct Texture
 {
 	GLuint id;
 	string type;
-	aiString path;
+	// The file's canonical path (see TextureRegistry::Canonicalize). Unlike id, never reused for a different image.
+	string path;
 };
 
 class Mesh
 {
 public:
 	/*  Mesh Data  */
+	// CPU copies of the geometry, what is left of them after upload depends on the residency (see GetResidency)
 	vector<Vertex> vertices;
 	vector<GLuint> indices;
+	// Vertex positions, only filled in with RESIDENCY_COMPACT
+	vector<glm::vec3> positions;
 	vector<Texture> textures;
 
 	/*  Functions  */
-	// Constructor
-	Mesh(vector<Vertex> vertices, vector<GLuint> indices, vector<Texture> textures)
+	// Constructor, with an arena the geometry goes into its shared buffers instead of buffers of its own.
+	// The data is moved in, so pass it with move() to hand over the buffers without copying them.
+	Mesh(vector<Vertex> vertices, vector<GLuint> indices, vector<Texture> textures, GeometryArena *arena = nullptr, MeshResidency residency = RESIDENCY_KEEP)
+		: vertices(move(vertices)), indices(move(indices)), textures(move(textures))
 	{
-		this->vertices = vertices;
-		this->indices = indices;
-		this->textures = textures;
+		this->arena = arena;
+		this->vertexCount = (GLsizei)this->vertices.size();
+		this->indexCount = (GLsizei)this->indices.size();
+		this->materialID = GetMaterialID(this->textures);
+		this->setupSamplerNames();
 
 		// Now that we have all the required data, set the vertex buffers and its attribute pointers.
 		this->setupMesh();
+
+		// The GPU has its copy now, drop whatever the CPU doesn't need
+		this->applyResidency(residency);
 	}
 
+	// Meshes own GL objects and can be large, so they are moved around rather than copied
+	Mesh(Mesh &&) = default;
+	Mesh &operator=(Mesh &&) = default;
+
 	// Render the mesh
-	void Draw(Shader shader)
+	void Draw(Shader &shader)
+	{
+		this->BindTextures(shader);
+
+		// Draw mesh
+		if (this->arena)
+		{
+			// Every arena mesh draws from the same VAO, so it stays bound for the next one
+			this->arena->Bind();
+			this->arena->Draw(this->range);
+		}
+		else
+		{
+			glBindVertexArray(this->VAO);
+			glDrawElements(GL_TRIANGLES, this->indexCount, GL_UNSIGNED_INT, 0);
+			glBindVertexArray(0);
+		}
+
+		this->UnbindTextures();
+	}
+
+	// Render the mesh through a state tracker: binds already in effect are skipped, and nothing is unbound afterwards,
+	// so a following mesh with the same textures or VAO gets them for free. Used by RenderQueue.
+	void Draw(Shader &shader, StateTracker &state)
+	{
+		this->setSamplers(shader);
+
+		for (GLuint i = 0; i < this->textures.size(); i++)
+		{
+			state.BindTexture2D(i, this->textures[i].id);
+		}
+
+		state.BindVertexArray(this->GetVAO());
+
+		if (this->arena)
+		{
+			this->arena->Draw(this->range);
+		}
+		else
+		{
+			glDrawElements(GL_TRIANGLES, this->indexCount, GL_UNSIGNED_INT, 0);
+		}
+	}
+
+	// Render one copy of the mesh per entry in the instance buffer, in a single draw call.
+	// The shader has to read its transforms from the instance attributes (see modelLoadingInstancedVertex.txt).
+	void DrawInstanced(Shader &shader, const InstanceBuffer &instances)
+	{
+		if (0 == instances.GetCount())
+		{
+			return;
+		}
+
+		this->BindTextures(shader);
+
+		if (this->arena)
+		{
+			this->arena->BindInstanced(instances);
+			this->arena->DrawInstanced(this->range, instances.GetCount());
+			glBindVertexArray(0);
+		}
+		else
+		{
+			glBindVertexArray(this->VAO);
+
+			// The attribute pointers live in the VAO, so they only need setting again when the buffer changes
+			if (this->instanceVBO != instances.GetID())
+			{
+				instances.BindAttributes();
+				this->instanceVBO = instances.GetID();
+			}
+
+			glDrawElementsInstanced(GL_TRIANGLES, this->indexCount, GL_UNSIGNED_INT, 0, instances.GetCount());
+			glBindVertexArray(0);
+		}
+
+		this->UnbindTextures();
+	}
+
+	// Binds the textures and points the samplers at them. Draw does this itself, it is only needed when the
+	// geometry is drawn some other way (e.g. by SceneRenderer)
+	void BindTextures(Shader &shader)
+	{
+		this->setSamplers(shader);
+
+		for (GLuint i = 0; i < this->textures.size(); i++)
+		{
+			glActiveTexture(GL_TEXTURE0 + i); // Active proper texture unit before binding
+			glBindTexture(GL_TEXTURE_2D, this->textures[i].id);
+		}
+	}
+
+	void UnbindTextures()
+	{
+		// Always good practice to set everything back to defaults once configured.
+		for (GLuint i = 0; i < this->textures.size(); i++)
+		{
+			glActiveTexture(GL_TEXTURE0 + i);
+			glBindTexture(GL_TEXTURE_2D, 0);
+		}
+	}
+
+	// Looks up the sampler uniforms of this mesh in the shader ahead of time, so the first draw with it doesn't have to
+	void PrepareShader(const Shader &shader)
+	{
+		this->getShaderBinding(shader);
+	}
+
+	// Shared buffers the geometry lives in, nullptr when the mesh has a VAO of its own
+	GeometryArena *GetArena() const
+	{
+		return this->arena;
+	}
+
+	// Where the geometry lives in the arena, only meaningful when GetArena() isn't nullptr
+	const GeometryRange &GetRange() const
+	{
+		return this->range;
+	}
+
+	// The VAO the mesh draws from, its own or the arena's
+	GLuint GetVAO() const
+	{
+		return this->arena ? this->arena->GetVAO() : this->VAO;
+	}
+
+	MeshResidency GetResidency() const
+	{
+		return this->residency;
+	}
+
+	// System memory held by the geometry
+	size_t GetCPUBytes() const
+	{
+		return this->vertices.capacity() * sizeof(Vertex) + this->indices.capacity() * sizeof(GLuint) + this->positions.capacity() * sizeof(glm::vec3);
+	}
+
+	// Video memory taken by the geometry, its own buffers or its share of the arena's
+	size_t GetGPUBytes() const
+	{
+		return this->vertexCount * sizeof(Vertex) + this->indexCount * sizeof(GLuint);
+	}
+
+	// Meshes with the same textures (in the same order) share a material ID, so draws can be grouped by it
+	GLuint GetMaterialID() const
+	{
+		return this->materialID;
+	}
+
+	// The first diffuse texture, 0 if there is none
+	GLuint GetDiffuseTexture() const
+	{
+		for (GLuint i = 0; i < this->textures.size(); i++)
+		{
+			if ("texture_diffuse" == this->textures[i].type)
+			{
+				return this->textures[i].id;
+			}
+		}
+
+		return 0;
+	}
+
+	// Numbers each distinct texture set. Keyed by the texture paths rather than the GL names, which GL hands out again
+	// once the registry has deleted a texture.
+	static GLuint GetMaterialID(const vector<Texture> &textures)
+	{
+		static map<vector<string>, GLuint> materials;
+		vector<string> key;
+
+		for (GLuint i = 0; i < textures.size(); i++)
+		{
+			key.push_back(textures[i].path);
+		}
+
+		map<vector<string>, GLuint>::iterator material = materials.find(key);
+
+		if (material == materials.end())
+		{
+			material = materials.insert(make_pair(key, (GLuint)materials.size())).first;
+		}
+
+		return material->second;
+	}
+
+private:
+	/*  Render data  */
+	GLuint VAO, VBO, EBO;
+	// Instance buffer the VAO's instance attributes currently point at, 0 if none
+	GLuint instanceVBO = 0;
+	// Shared buffers the geometry lives in (nullptr when the mesh has its own VAO) and where in them
+	GeometryArena *arena;
+	GeometryRange range;
+	GLuint materialID;
+	// Uploaded sizes, kept separately since the CPU copies may be gone
+	GLsizei vertexCount, indexCount;
+	MeshResidency residency;
+
+	// Sampler uniform name of each texture, and their locations (plus material.shininess) in each shader used so far
+	struct ShaderBinding
+	{
+		GLuint program;
+		vector<GLint> samplerLocations;
+		GLint shininessLocation;
+	};
+
+	vector<string> samplerNames;
+	vector<ShaderBinding> shaderBindings;
+
+	/*  Functions    */
+	// Points each sampler at its texture unit (texture i goes to unit i). Uses the locations cached for the shader,
+	// so this does no string work or allocation once the shader has been prepared.
+	void setSamplers(const Shader &shader)
+	{
+		const ShaderBinding &binding = this->getShaderBinding(shader);
+
+		for (GLuint i = 0; i < binding.samplerLocations.size(); i++)
+		{
+			glUniform1i(binding.samplerLocations[i], i);
+		}
+
+		// Also set each mesh's shininess property to a default value (if you want you could extend this to another mesh property and possibly change this value)
+		glUniform1f(binding.shininessLocation, 16.0f);
+	}
+
+	// Works out the sampler name of every texture once, e.g. texture_diffuse1, texture_diffuse2, texture_specular1
+	void setupSamplerNames()
 	{
-		// Bind appropriate textures
 		GLuint diffuseNr = 1;
 		GLuint specularNr = 1;
 
 		for (GLuint i = 0; i < this->textures.size(); i++)
 		{
-			glActiveTexture(GL_TEXTURE0 + i); // Active proper texture unit before binding
 			// Retrieve texture number (the N in diffuse_textureN)
 			stringstream ss;
-			string number;
 			string name = this->textures[i].type;
 
 			if (name == "texture_diffuse")
@@ -73,37 +318,73 @@ public:
 				ss << specularNr++; // Transfer GLuint to stream
 			}
 
-			number = ss.str();
-			// Now set the sampler to the correct texture unit
-			glUniform1i(glGetUniformLocation(shader.Program, (name + number).c_str()), i);
-			// And finally bind the texture
-			glBindTexture(GL_TEXTURE_2D, this->textures[i].id);
+			this->samplerNames.push_back(name + ss.str());
 		}
+	}
 
-		// Also set each mesh's shininess property to a default value (if you want you could extend this to another mesh property and possibly change this value)
-		glUniform1f(glGetUniformLocation(shader.Program, "material.shininess"), 16.0f);
+	// Uniform locations for the given shader, looked up on first use unless PrepareShader was called for it
+	const ShaderBinding &getShaderBinding(const Shader &shader)
+	{
+		for (GLuint i = 0; i < this->shaderBindings.size(); i++)
+		{
+			if (this->shaderBindings[i].program == shader.Program)
+			{
+				return this->shaderBindings[i];
+			}
+		}
 
-		// Draw mesh
-		glBindVertexArray(this->VAO);
-		glDrawElements(GL_TRIANGLES, this->indices.size(), GL_UNSIGNED_INT, 0);
-		glBindVertexArray(0);
+		ShaderBinding binding;
+		binding.program = shader.Program;
+		binding.shininessLocation = shader.GetUniformLocation("material.shininess");
 
-		// Always good practice to set everything back to defaults once configured.
-		for (GLuint i = 0; i < this->textures.size(); i++)
+		for (GLuint i = 0; i < this->samplerNames.size(); i++)
 		{
-			glActiveTexture(GL_TEXTURE0 + i);
-			glBindTexture(GL_TEXTURE_2D, 0);
+			binding.samplerLocations.push_back(shader.GetUniformLocation(this->samplerNames[i].c_str()));
 		}
+
+		this->shaderBindings.push_back(binding);
+
+		return this->shaderBindings.back();
 	}
 
-private:
-	/*  Render data  */
-	GLuint VAO, VBO, EBO;
+	// Releases the CPU copies the residency doesn't keep. swap() rather than clear(), so the memory is actually freed.
+	void applyResidency(MeshResidency residency)
+	{
+		this->residency = residency;
+
+		if (RESIDENCY_KEEP == residency)
+		{
+			return;
+		}
+
+		if (RESIDENCY_COMPACT == residency)
+		{
+			this->positions.reserve(this->vertices.size());
+
+			for (GLuint i = 0; i < this->vertices.size(); i++)
+			{
+				this->positions.push_back(this->vertices[i].Position);
+			}
+		}
+		else
+		{
+			vector<GLuint>().swap(this->indices);
+		}
+
+		vector<Vertex>().swap(this->vertices);
+	}
 
-	/*  Functions    */
 	// Initializes all the buffer objects/arrays
 	void setupMesh()
 	{
+		if (this->arena)
+		{
+			this->range = this->arena->Allocate(this->vertices, this->indices);
+			this->VAO = this->VBO = this->EBO = 0;
+
+			return;
+		}
+
 		// Create buffers/arrays
 		glGenVertexArrays(1, &this->VAO);
 		glGenBuffers(1, &this->VBO);
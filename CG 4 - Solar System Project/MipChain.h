@@ -0,0 +1,206 @@
+#pragma once
+
+#include <vector>
+#include <future>
+#include <cmath>
+#include <algorithm>
+
+#include <GL/glew.h>
+
+#include "ImageData.h"
+#include "ThreadPool.h"
+#include "Simd.h"
+
+// Define MIP_CHAIN_NO_SIMD to force the scalar filter here alone
+#if defined(SOLAR_SSE2) && !defined(MIP_CHAIN_NO_SIMD)
+#define MIP_CHAIN_SSE
+#endif
+
+using namespace std;
+
+// Builds mip chains on the CPU, so textures can be uploaded (or cached) level by level instead of leaving it to
+// glGenerateMipmap on the GL thread.
+//  - Each level halves the previous one with a 2x2 box filter down to 1x1, clamping at odd edges.
+//  - Filtering happens in linear light: the sRGB texels are decoded through a table, and the levels are carried as
+//    linear floats from one step to the next, so every level is rounded to 8 bits only once. Averaging the sRGB
+//    values directly darkens high contrast detail (a starfield fades out in the distance).
+//  - With a pool each level's rows are split over its workers. Don't pass the pool from one of its own jobs, the
+//    caller waits for the bands and would deadlock a fully busy pool.
+class MipChain
+{
+public:
+	// Level 0 is the image itself (sharing its pixels), the last level is 1x1
+	static vector<ImageData> Generate(const ImageData &image, ThreadPool *pool = nullptr)
+	{
+		vector<ImageData> levels(1, image);
+
+		if (!image.pixels)
+		{
+			return levels;
+		}
+
+		int width = image.width;
+		int height = image.height;
+		vector<float> linear((size_t)width * height * 3);
+		const float *toLinear = GetToLinearTable();
+		const unsigned char *pixels = image.pixels.get();
+
+		for (size_t i = 0; i < linear.size(); i++)
+		{
+			linear[i] = toLinear[pixels[i]];
+		}
+
+		while (width > 1 || height > 1)
+		{
+			ImageData next;
+			next.width = max(1, width / 2);
+			next.height = max(1, height / 2);
+			next.pixels = shared_ptr<unsigned char>(new unsigned char[(size_t)next.width * next.height * 3], default_delete<unsigned char[]>());
+
+			vector<float> nextLinear((size_t)next.width * next.height * 3);
+			const float *src = &linear[0];
+			float *dst = &nextLinear[0];
+			unsigned char *out = next.pixels.get();
+			int nextWidth = next.width;
+
+			if (pool && next.height > 1)
+			{
+				// Bands of whole rows, small levels aren't worth splitting
+				int bands = (int)min<size_t>(pool->GetThreadCount(), (size_t)max(1, next.width * next.height / MIN_BAND_TEXELS));
+				int rows = (next.height + max(1, bands) - 1) / max(1, bands);
+				vector<future<void>> pending;
+
+				for (int begin = 0; begin < next.height; begin += rows)
+				{
+					int end = min(next.height, begin + rows);
+					pending.push_back(pool->Enqueue([=]() { downsampleRows(src, width, height, dst, out, nextWidth, begin, end); }));
+				}
+
+				for (size_t i = 0; i < pending.size(); i++)
+				{
+					pending[i].get();
+				}
+			}
+			else
+			{
+				downsampleRows(src, width, height, dst, out, nextWidth, 0, next.height);
+			}
+
+			levels.push_back(next);
+			linear.swap(nextLinear);
+			width = next.width;
+			height = next.height;
+		}
+
+		return levels;
+	}
+
+	// Uploads every level to the bound texture's target (GL_TEXTURE_2D or a cube map face), as GL_RGB
+	static void Upload(GLenum target, const vector<ImageData> &levels)
+	{
+		// Odd sized levels have rows that aren't a multiple of 4 bytes
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+		for (size_t i = 0; i < levels.size(); i++)
+		{
+			glTexImage2D(target, (GLint)i, GL_RGB, levels[i].width, levels[i].height, 0, GL_RGB, GL_UNSIGNED_BYTE, levels[i].pixels.get());
+		}
+
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	}
+
+private:
+	// Rows per band are chosen so each band has at least this many texels
+	static const int MIN_BAND_TEXELS = 16384;
+	// Resolution of the linear to sRGB table, fine enough to be exact to 8 bits outside the darkest few values
+	static const int TO_SRGB_SIZE = 16384;
+
+	// sRGB byte to linear light
+	struct ToLinearTable
+	{
+		float values[256];
+
+		ToLinearTable()
+		{
+			for (int i = 0; i < 256; i++)
+			{
+				float c = i / 255.0f;
+				this->values[i] = (c <= 0.04045f) ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+			}
+		}
+	};
+
+	// Linear light in [0, 1], sampled TO_SRGB_SIZE times, to the nearest sRGB byte
+	struct ToSRGBTable
+	{
+		unsigned char values[TO_SRGB_SIZE + 1];
+
+		ToSRGBTable()
+		{
+			for (int i = 0; i <= TO_SRGB_SIZE; i++)
+			{
+				float l = (float)i / TO_SRGB_SIZE;
+				float c = (l <= 0.0031308f) ? l * 12.92f : 1.055f * powf(l, 1.0f / 2.4f) - 0.055f;
+				this->values[i] = (unsigned char)min(255.0f, max(0.0f, c * 255.0f + 0.5f));
+			}
+		}
+	};
+
+	// Function statics are initialised once, even when several workers get here at the same time
+	static const float *GetToLinearTable()
+	{
+		static const ToLinearTable table;
+		return table.values;
+	}
+
+	static const unsigned char *GetToSRGBTable()
+	{
+		static const ToSRGBTable table;
+		return table.values;
+	}
+
+	// Fills rows [begin, end) of the next level, both as linear floats (for the level after it) and as sRGB bytes
+	static void downsampleRows(const float *src, int width, int height, float *dst, unsigned char *out, int nextWidth, int begin, int end)
+	{
+		const unsigned char *toSRGB = GetToSRGBTable();
+		vector<float> sum((size_t)width * 3);
+
+		for (int y = begin; y < end; y++)
+		{
+			const float *row0 = src + (size_t)min(y * 2, height - 1) * width * 3;
+			const float *row1 = src + (size_t)min(y * 2 + 1, height - 1) * width * 3;
+			int count = width * 3;
+			int i = 0;
+
+			// Vertical pair sums first, the rows are contiguous so this part vectorises cleanly
+#ifdef MIP_CHAIN_SSE
+			for (; i + 4 <= count; i += 4)
+			{
+				_mm_storeu_ps(&sum[i], _mm_add_ps(_mm_loadu_ps(row0 + i), _mm_loadu_ps(row1 + i)));
+			}
+#endif
+
+			for (; i < count; i++)
+			{
+				sum[i] = row0[i] + row1[i];
+			}
+
+			// Then horizontal pairs of RGB texels
+			float *dstRow = dst + (size_t)y * nextWidth * 3;
+			unsigned char *outRow = out + (size_t)y * nextWidth * 3;
+
+			for (int x = 0; x < nextWidth; x++)
+			{
+				const float *a = &sum[min(x * 2, width - 1) * 3];
+				const float *b = &sum[min(x * 2 + 1, width - 1) * 3];
+
+				for (int c = 0; c < 3; c++)
+				{
+					float value = (a[c] + b[c]) * 0.25f;
+					dstRow[x * 3 + c] = value;
+					outRow[x * 3 + c] = toSRGB[(int)(min(value, 1.0f) * TO_SRGB_SIZE + 0.5f)];
+				}
+			}
+		}
+	}
+};
@@ -6,6 +6,8 @@
 #include <iostream>
 #include <map>
 #include <vector>
+#include <chrono>
+#include <memory>
 
 #include <GL/glew.h>
 #include <glm/glm.hpp>
@@ -16,13 +18,34 @@
 #include <assimp/postprocess.h>
 
 #include "Mesh.h"
+#include "ModelCache.h"
+#include "ImageData.h"
+#include "TextureStreamer.h"
+#include "TextureCache.h"
+#include "MipChain.h"
+#include "TextureRegistry.h"
 
 
 
 using namespace std;
 
+GLuint UploadTexture(const ImageData &image);
+GLuint UploadTexture(const CompressedImage &image);
 GLint TextureFromFile(const char* modelPath, string directory);
 
+// Post-processing applied by ASSIMP, also part of the model cache key
+const unsigned int MODEL_IMPORT_FLAGS = aiProcess_Triangulate | aiProcess_FlipUVs;
+
+// Everything the CPU phase of loading a model produces: the flattened meshes and the decoded images of every
+// texture they reference. Model::Import fills this in without touching GL, so it can run on a worker thread.
+struct ModelData
+{
+	string path;
+	string directory;
+	vector<CachedMesh> meshes;
+	map<string, ImageData> images;
+};
+
 class Model
 {
 public:
@@ -31,11 +54,86 @@ public:
 	// Constructor, expects a filepath to a 3D model.
 	Model(string const &modelPath)
 	{
-		loadModel(modelPath);
+		ModelData data = Import(modelPath);
+		this->upload(data);
+	}
+
+	// Constructor from an already imported model, only does the GL upload. Must run on the context thread.
+	// With a streamer the textures start out as placeholders and stream in over the next frames.
+	// With an arena the meshes are sub-allocated from its shared buffers rather than getting buffers of their own.
+	// The residency decides how much of the geometry stays in system memory once it is on the GPU.
+	Model(ModelData &&data, TextureStreamer *streamer = nullptr, GeometryArena *arena = nullptr, MeshResidency residency = RESIDENCY_KEEP)
+	{
+		this->upload(data, streamer, arena, residency);
+	}
+
+	// Hands the textures back to the registry, which deletes those no other model uses
+	~Model()
+	{
+		for (GLuint i = 0; i < this->textureReferences.size(); i++)
+		{
+			TextureRegistry::Instance().Release(this->textureReferences[i]);
+		}
+	}
+
+	// CPU phase of loading: parses the model (or reads its cache) and, unless a TextureStreamer will do it later,
+	// decodes its textures. Makes no GL calls, so several models can be imported concurrently on a ThreadPool.
+	static ModelData Import(const string &path, bool decodeTextures = true)
+	{
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+		ModelData data;
+		data.path = path;
+		// Retrieve the directory path of the filepath
+		data.directory = path.substr(0, path.find_last_of('/'));
+
+		bool cacheHit = ModelCache::Load(path, MODEL_IMPORT_FLAGS, data.meshes);
+
+		if (!cacheHit)
+		{
+			// Read file via ASSIMP
+			Assimp::Importer importer;
+			const aiScene *scene = importer.ReadFile(path, MODEL_IMPORT_FLAGS);
+
+			// Check for errors
+			if (!scene || scene->mFlags == AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
+			{
+				cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << endl;
+				return data;
+			}
+
+			// Process ASSIMP's root node recursively. Nodes usually reference each mesh once, so this is the final count.
+			data.meshes.reserve(scene->mNumMeshes);
+			processNode(scene->mRootNode, scene, data.meshes);
+
+			ModelCache::Save(path, MODEL_IMPORT_FLAGS, data.meshes);
+		}
+
+		// Decode every texture once, even if several meshes share it, and not at all if another model already loaded it
+		for (GLuint i = 0; decodeTextures && i < data.meshes.size(); i++)
+		{
+			for (GLuint j = 0; j < data.meshes[i].textures.size(); j++)
+			{
+				const string &texturePath = data.meshes[i].textures[j].second;
+
+				if (0 == data.images.count(texturePath) && !TextureRegistry::Instance().IsLoaded(data.directory + '/' + texturePath))
+				{
+					data.images[texturePath] = LoadImageData(texturePath.c_str(), data.directory);
+				}
+			}
+		}
+
+		// One write per line, imports run on several threads at once
+		stringstream log;
+		log << "Imported " << path << (cacheHit ? " from cache" : " via ASSIMP") << " in "
+			<< chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() << " ms" << endl;
+		cout << log.str();
+
+		return data;
 	}
 
 	// Draws the model, and thus all its meshes
-	void Draw(Shader shader)
+	void Draw(Shader &shader)
 	{
 		for (GLuint i = 0; i < this->meshes.size(); i++)
 		{
@@ -43,35 +141,84 @@ public:
 		}
 	}
 
+	// Draws one copy of the model per instance, with one draw call per mesh however many instances there are
+	void DrawInstanced(Shader &shader, const InstanceBuffer &instances)
+	{
+		for (GLuint i = 0; i < this->meshes.size(); i++)
+		{
+			this->meshes[i].DrawInstanced(shader, instances);
+		}
+	}
+
+	// Caches the sampler uniform locations of every mesh for the shader, call once per shader the model is drawn with
+	void PrepareShader(const Shader &shader)
+	{
+		for (GLuint i = 0; i < this->meshes.size(); i++)
+		{
+			this->meshes[i].PrepareShader(shader);
+		}
+	}
+
+	vector<Mesh> &GetMeshes()
+	{
+		return this->meshes;
+	}
+
+	const string &GetPath() const
+	{
+		return this->path;
+	}
+
+	// Geometry memory of all meshes, in system and in video memory (textures not included)
+	size_t GetCPUBytes() const
+	{
+		size_t bytes = 0;
+
+		for (GLuint i = 0; i < this->meshes.size(); i++)
+		{
+			bytes += this->meshes[i].GetCPUBytes();
+		}
+
+		return bytes;
+	}
+
+	size_t GetGPUBytes() const
+	{
+		size_t bytes = 0;
+
+		for (GLuint i = 0; i < this->meshes.size(); i++)
+		{
+			bytes += this->meshes[i].GetGPUBytes();
+		}
+
+		return bytes;
+	}
+
 private:
 	/*  Model Data  */
 	vector<Mesh> meshes;
+	string path;
 	string directory;
-	vector<Texture> textures_loaded;	// Stores all the textures loaded so far, optimization to make sure textures aren't loaded more than once.
+	// One entry per texture acquired from the TextureRegistry, released again by the destructor
+	vector<GLuint> textureReferences;
 
 	/*  Functions   */
-	// Loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
-	void loadModel(string path)
+	// GL phase of loading: uploads the decoded textures and creates the mesh buffers. The vertex and index data is
+	// moved out of data into the meshes.
+	void upload(ModelData &data, TextureStreamer *streamer = nullptr, GeometryArena *arena = nullptr, MeshResidency residency = RESIDENCY_KEEP)
 	{
-		// Read file via ASSIMP
-		Assimp::Importer importer;
-		const aiScene *scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs);
+		this->path = data.path;
+		this->directory = data.directory;
+		this->meshes.reserve(data.meshes.size());
 
-		// Check for errors
-		if (!scene || scene->mFlags == AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
+		for (GLuint i = 0; i < data.meshes.size(); i++)
 		{
-			cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << endl;
-			return;
+			this->meshes.push_back(this->setupMesh(data.meshes[i], data.images, streamer, arena, residency));
 		}
-		// Retrieve the directory path of the filepath
-		this->directory = path.substr(0, path.find_last_of('/'));
-
-		// Process ASSIMP's root node recursively
-		this->processNode(scene->mRootNode, scene);
 	}
 
 	// Processes a node in a recursive fashion. Processes each individual mesh located at the node and repeats this process on its children nodes (if any).
-	void processNode(aiNode* node, const aiScene* scene)
+	static void processNode(aiNode* node, const aiScene* scene, vector<CachedMesh> &meshData)
 	{
 		// Process each mesh located at the current node
 		for (GLuint i = 0; i < node->mNumMeshes; i++)
@@ -80,22 +227,26 @@ private:
 			// The scene contains all the data, node is just to keep stuff organized (like relations between nodes).
 			aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
 
-			this->meshes.push_back(this->processMesh(mesh, scene));
+			meshData.push_back(processMesh(mesh, scene));
 		}
 
 		// After we've processed all of the meshes (if any) we then recursively process each of the children nodes
 		for (GLuint i = 0; i < node->mNumChildren; i++)
 		{
-			this->processNode(node->mChildren[i], scene);
+			processNode(node->mChildren[i], scene, meshData);
 		}
 	}
 
-	Mesh processMesh(aiMesh *mesh, const aiScene *scene)
+	static CachedMesh processMesh(aiMesh *mesh, const aiScene *scene)
 	{
 		// Data to fill
-		vector<Vertex> vertices;
-		vector<GLuint> indices;
-		vector<Texture> textures;
+		CachedMesh data;
+		vector<Vertex> &vertices = data.vertices;
+		vector<GLuint> &indices = data.indices;
+
+		// Size both buffers up front, after triangulation every face has 3 indices
+		vertices.reserve(mesh->mNumVertices);
+		indices.reserve(mesh->mNumFaces * 3);
 
 		// Walk through each of the mesh's vertices
 		for (GLuint i = 0; i < mesh->mNumVertices; i++)
@@ -136,7 +287,7 @@ private:
 		// Now walk through each of the mesh's faces (a face is a mesh its triangle) and retrieve the corresponding vertex indices.
 		for (GLuint i = 0; i < mesh->mNumFaces; i++)
 		{
-			aiFace face = mesh->mFaces[i];
+			const aiFace &face = mesh->mFaces[i];
 			// Retrieve all indices of the face and store them in the indices vector
 			for (GLuint j = 0; j < face.mNumIndices; j++)
 			{
@@ -156,75 +307,100 @@ private:
 			// Normal: texture_normalN
 
 			// 1. Diffuse maps
-			vector<Texture> diffuseMaps = this->loadMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse");
-			textures.insert(textures.end(), diffuseMaps.begin(), diffuseMaps.end());
+			getMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse", data.textures);
 
 			// 2. Specular maps
-			vector<Texture> specularMaps = this->loadMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular");
-			textures.insert(textures.end(), specularMaps.begin(), specularMaps.end());
+			getMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular", data.textures);
 		}
 
-		// Return a mesh object created from the extracted mesh data
-		return Mesh(vertices, indices, textures);
+		// Return the extracted mesh data, the GL side is created in setupMesh
+		return data;
 	}
 
-	// Checks all material textures of a given type and loads the textures if they're not loaded yet.
-	// The required info is returned as a Texture struct.
-	vector<Texture> loadMaterialTextures(aiMaterial *mat, aiTextureType type, string typeName)
+	// Collects the paths of all material textures of a given type
+	static void getMaterialTextures(aiMaterial *mat, aiTextureType type, string typeName, vector<pair<string, string>> &textures)
 	{
-		vector<Texture> textures;
-
 		for (GLuint i = 0; i < mat->GetTextureCount(type); i++)
 		{
 			aiString str;
 			mat->GetTexture(type, i, &str);
+			textures.push_back(make_pair(typeName, string(str.C_Str())));
+		}
+	}
 
-			// Check if texture was loaded before and if so, continue to next iteration: skip loading a new texture
-			GLboolean skip = false;
+	// Creates a mesh object from the extracted (or cached) mesh data, taking over its vertex and index buffers
+	Mesh setupMesh(CachedMesh &data, const map<string, ImageData> &images, TextureStreamer *streamer, GeometryArena *arena, MeshResidency residency)
+	{
+		vector<Texture> textures;
+		textures.reserve(data.textures.size());
 
-			for (GLuint j = 0; j < textures_loaded.size(); j++)
-			{
-				if (textures_loaded[j].path == str)
-				{
-					textures.push_back(textures_loaded[j]);
-					skip = true; // A texture with the same filepath has already been loaded, continue to next one. (optimization)
+		for (GLuint i = 0; i < data.textures.size(); i++)
+		{
+			textures.push_back(this->loadMaterialTexture(data.textures[i].second, data.textures[i].first, images, streamer));
+		}
 
-					break;
-				}
-			}
+		return Mesh(move(data.vertices), move(data.indices), move(textures), arena, residency);
+	}
 
-			if (!skip)
-			{   // If texture hasn't been loaded already, load it
-				Texture texture;
-				texture.id = TextureFromFile(str.C_Str(), this->directory);
-				texture.type = typeName;
-				texture.path = str;
-				textures.push_back(texture);
+	// Gets a material texture from the TextureRegistry, which only loads it if no model (this one included) has yet.
+	// The required info is returned as a Texture struct.
+	Texture loadMaterialTexture(const string &path, const string &typeName, const map<string, ImageData> &images, TextureStreamer *streamer)
+	{
+		Texture texture;
+		map<string, ImageData>::const_iterator image = images.find(path);
+		const string &directory = this->directory;
 
-				this->textures_loaded.push_back(texture);  // Store it as texture loaded for entire model, to ensure we won't unnecesery load duplicate textures.
+		texture.id = TextureRegistry::Instance().Acquire(directory + '/' + path, [&]() -> GLuint
+		{
+			if (streamer)
+			{
+				return (image != images.end()) ? streamer->Request(path, image->second) : streamer->Request(path, directory);
 			}
-		}
 
-		return textures;
+			return (image != images.end()) ? UploadTexture(image->second) : TextureFromFile(path.c_str(), directory);
+		});
+		texture.type = typeName;
+		texture.path = TextureRegistry::Canonicalize(directory + '/' + path);
+
+		this->textureReferences.push_back(texture.id);
+
+		return texture;
 	}
+
+	// The destructor releases the textures, so a copy would release them twice
+	Model(const Model &);
+	Model &operator=(const Model &);
 };
 
-GLint TextureFromFile(const char *path, string directory)
+GLuint UploadTexture(const ImageData &image)
 {
 	//Generate texture ID and load texture data
-	string filename = string(path);
-	filename = directory + '/' + filename;
 	GLuint textureID;
 	glGenTextures(1, &textureID);
 
-	int width, height;
+	// Assign texture to ID, with the mip chain built on the CPU
+	glBindTexture(GL_TEXTURE_2D, textureID);
+	MipChain::Upload(GL_TEXTURE_2D, MipChain::Generate(image));
 
-	unsigned char *image = SOIL_load_image(filename.c_str(), &width, &height, 0, SOIL_LOAD_RGB);
+	// Parameters
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	return textureID;
+}
+
+// Uploads a whole compressed mip chain as it is, no mipmap generation needed
+GLuint UploadTexture(const CompressedImage &image)
+{
+	GLuint textureID;
+	glGenTextures(1, &textureID);
 
-	// Assign texture to ID
 	glBindTexture(GL_TEXTURE_2D, textureID);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
-	glGenerateMipmap(GL_TEXTURE_2D);
+	TextureCache::Upload(GL_TEXTURE_2D, image);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)image.levels.size() - 1);
 
 	// Parameters
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
@@ -232,7 +408,20 @@ GLint TextureFromFile(const char *path, string directory)
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 	glBindTexture(GL_TEXTURE_2D, 0);
-	SOIL_free_image_data(image);
 
 	return textureID;
-}
\ No newline at end of file
+}
+
+// Goes through the TextureCache where S3TC is supported, so only the first run decodes the file
+GLint TextureFromFile(const char *path, string directory)
+{
+	CompressedImage compressed;
+	bool transcoded;
+
+	if (TextureCache::IsSupported() && TextureCache::Get(directory + '/' + path, compressed, transcoded))
+	{
+		return UploadTexture(compressed);
+	}
+
+	return UploadTexture(LoadImageData(path, directory));
+}
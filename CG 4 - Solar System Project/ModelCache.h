@@ -0,0 +1,333 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstring>
+#include <cstdint>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "Mesh.h"
+
+using namespace std;
+
+// Bump this whenever the file layout or the Vertex struct changes so old caches get rebuilt
+const uint32_t MODEL_CACHE_VERSION = 1;
+
+// Flattened data for one mesh, exactly what Mesh needs to be constructed
+struct CachedMesh
+{
+	vector<Vertex> vertices;
+	vector<GLuint> indices;
+	// (type, path) pairs, e.g. ("texture_diffuse", "Earth.jpg")
+	vector<pair<string, string>> textures;
+};
+
+// Read-only memory mapping of a whole file
+class MappedFile
+{
+public:
+	MappedFile(const string &path) : data(nullptr), size(0)
+	{
+#ifdef _WIN32
+		this->file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		this->mapping = NULL;
+
+		if (INVALID_HANDLE_VALUE == this->file)
+		{
+			return;
+		}
+
+		LARGE_INTEGER fileSize;
+		GetFileSizeEx(this->file, &fileSize);
+		this->mapping = CreateFileMappingA(this->file, NULL, PAGE_READONLY, 0, 0, NULL);
+
+		if (NULL != this->mapping)
+		{
+			this->data = (const char *)MapViewOfFile(this->mapping, FILE_MAP_READ, 0, 0, 0);
+			this->size = (size_t)fileSize.QuadPart;
+		}
+#else
+		this->fd = open(path.c_str(), O_RDONLY);
+
+		if (-1 == this->fd)
+		{
+			return;
+		}
+
+		struct stat info;
+
+		if (0 == fstat(this->fd, &info) && info.st_size > 0)
+		{
+			void *mapped = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, this->fd, 0);
+
+			if (MAP_FAILED != mapped)
+			{
+				this->data = (const char *)mapped;
+				this->size = (size_t)info.st_size;
+			}
+		}
+#endif
+	}
+
+	~MappedFile()
+	{
+#ifdef _WIN32
+		if (this->data)
+		{
+			UnmapViewOfFile(this->data);
+		}
+
+		if (NULL != this->mapping)
+		{
+			CloseHandle(this->mapping);
+		}
+
+		if (INVALID_HANDLE_VALUE != this->file)
+		{
+			CloseHandle(this->file);
+		}
+#else
+		if (this->data)
+		{
+			munmap((void *)this->data, this->size);
+		}
+
+		if (-1 != this->fd)
+		{
+			close(this->fd);
+		}
+#endif
+	}
+
+	const char *data;
+	size_t size;
+
+private:
+#ifdef _WIN32
+	HANDLE file;
+	HANDLE mapping;
+#else
+	int fd;
+#endif
+
+	MappedFile(const MappedFile &);
+	MappedFile &operator=(const MappedFile &);
+};
+
+// Binary cache of the meshes Assimp produces for a model file, stored next to the model as "<model>.meshcache".
+// The cache is keyed on the source path, its size and modification time, the Assimp import flags and the
+// Vertex layout, so editing the model or changing any of those silently falls back to Assimp and rewrites it.
+class ModelCache
+{
+public:
+	static string GetCachePath(const string &modelPath)
+	{
+		return modelPath + ".meshcache";
+	}
+
+	// Returns false on a miss (no cache, stale cache or corrupt cache)
+	static bool Load(const string &modelPath, uint32_t importFlags, vector<CachedMesh> &meshes)
+	{
+		Header expected;
+
+		if (!MakeHeader(modelPath, importFlags, expected))
+		{
+			return false;
+		}
+
+		MappedFile file(GetCachePath(modelPath));
+		Reader reader(file.data, file.size);
+
+		Header header;
+
+		if (!file.data || !reader.Read(&header, sizeof(header)) || 0 != memcmp(&header, &expected, sizeof(header)))
+		{
+			return false;
+		}
+
+		string sourcePath;
+		uint32_t meshCount;
+
+		if (!reader.ReadString(sourcePath) || sourcePath != modelPath || !reader.Read(&meshCount, sizeof(meshCount)))
+		{
+			return false;
+		}
+
+		// Counts are checked against what is left of the file before anything is allocated for them, a corrupt count
+		// must not turn into a huge allocation. Every mesh takes at least its three counts.
+		if ((uint64_t)meshCount * sizeof(uint32_t[3]) > reader.remaining)
+		{
+			return false;
+		}
+
+		vector<CachedMesh> loaded(meshCount);
+
+		for (uint32_t i = 0; i < meshCount; i++)
+		{
+			CachedMesh &mesh = loaded[i];
+			uint32_t counts[3];
+
+			// Each texture takes at least the lengths of its two strings
+			if (!reader.Read(counts, sizeof(counts)) || (uint64_t)counts[0] * sizeof(Vertex) + (uint64_t)counts[1] * sizeof(GLuint) +
+				(uint64_t)counts[2] * 2 * sizeof(uint32_t) > reader.remaining)
+			{
+				return false;
+			}
+
+			mesh.textures.resize(counts[2]);
+
+			for (uint32_t j = 0; j < counts[2]; j++)
+			{
+				if (!reader.ReadString(mesh.textures[j].first) || !reader.ReadString(mesh.textures[j].second))
+				{
+					return false;
+				}
+			}
+
+			mesh.vertices.resize(counts[0]);
+			mesh.indices.resize(counts[1]);
+
+			if (!reader.Read(mesh.vertices.data(), counts[0] * sizeof(Vertex)) || !reader.Read(mesh.indices.data(), counts[1] * sizeof(GLuint)))
+			{
+				return false;
+			}
+		}
+
+		meshes.swap(loaded);
+
+		return true;
+	}
+
+	static void Save(const string &modelPath, uint32_t importFlags, const vector<CachedMesh> &meshes)
+	{
+		Header header;
+
+		if (!MakeHeader(modelPath, importFlags, header))
+		{
+			return;
+		}
+
+		ofstream out(GetCachePath(modelPath).c_str(), ios::binary | ios::trunc);
+
+		if (!out)
+		{
+			cout << "WARNING::MODEL_CACHE:: could not write " << GetCachePath(modelPath) << endl;
+			return;
+		}
+
+		uint32_t meshCount = (uint32_t)meshes.size();
+		out.write((const char *)&header, sizeof(header));
+		WriteString(out, modelPath);
+		out.write((const char *)&meshCount, sizeof(meshCount));
+
+		for (size_t i = 0; i < meshes.size(); i++)
+		{
+			const CachedMesh &mesh = meshes[i];
+			uint32_t counts[3] = { (uint32_t)mesh.vertices.size(), (uint32_t)mesh.indices.size(), (uint32_t)mesh.textures.size() };
+			out.write((const char *)counts, sizeof(counts));
+
+			for (size_t j = 0; j < mesh.textures.size(); j++)
+			{
+				WriteString(out, mesh.textures[j].first);
+				WriteString(out, mesh.textures[j].second);
+			}
+
+			out.write((const char *)mesh.vertices.data(), mesh.vertices.size() * sizeof(Vertex));
+			out.write((const char *)mesh.indices.data(), mesh.indices.size() * sizeof(GLuint));
+		}
+	}
+
+private:
+	struct Header
+	{
+		char magic[4];
+		uint32_t version;
+		uint32_t importFlags;
+		uint32_t vertexSize;
+		uint64_t sourceSize;
+		int64_t sourceTime;
+	};
+
+	// Bounds-checked cursor over the mapped file, so a truncated cache is a miss rather than a crash
+	struct Reader
+	{
+		Reader(const char *data, size_t size) : data(data), remaining(data ? size : 0) {}
+
+		bool Read(void *dst, size_t count)
+		{
+			if (count > this->remaining)
+			{
+				return false;
+			}
+
+			memcpy(dst, this->data, count);
+			this->data += count;
+			this->remaining -= count;
+
+			return true;
+		}
+
+		bool ReadString(string &str)
+		{
+			uint32_t length;
+
+			if (!this->Read(&length, sizeof(length)) || length > this->remaining)
+			{
+				return false;
+			}
+
+			str.assign(this->data, length);
+			this->data += length;
+			this->remaining -= length;
+
+			return true;
+		}
+
+		const char *data;
+		size_t remaining;
+	};
+
+	static bool MakeHeader(const string &modelPath, uint32_t importFlags, Header &header)
+	{
+		struct stat info;
+
+		if (0 != stat(modelPath.c_str(), &info))
+		{
+			return false;
+		}
+
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, "MDLC", 4);
+		header.version = MODEL_CACHE_VERSION;
+		header.importFlags = importFlags;
+		header.vertexSize = sizeof(Vertex);
+		header.sourceSize = (uint64_t)info.st_size;
+		header.sourceTime = (int64_t)info.st_mtime;
+
+		return true;
+	}
+
+	static void WriteString(ofstream &out, const string &str)
+	{
+		uint32_t length = (uint32_t)str.size();
+		out.write((const char *)&length, sizeof(length));
+		out.write(str.data(), length);
+	}
+};
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <cstring>
+#include <cstdint>
+
+#include <GL/glew.h>
+
+// On-disk cache of linked program binaries (glGetProgramBinary/glProgramBinary), so a warm start skips the GLSL compiler.
+// Each entry is keyed by a hash of the shader sources and the driver's vendor/renderer/version strings; a driver update
+// or a shader edit changes the key, and a binary the driver refuses is treated the same as a missing one.
+class ProgramBinaryCache
+{
+public:
+	// Whether the context can save and load program binaries at all
+	static bool IsSupported()
+	{
+		if (!GLEW_ARB_get_program_binary)
+		{
+			return false;
+		}
+
+		GLint formats = 0;
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+
+		return formats > 0;
+	}
+
+	static uint64_t MakeKey(const std::string &vertexCode, const std::string &fragmentCode)
+	{
+		uint64_t hash = 14695981039346656037ull;
+
+		hash = Hash(hash, vertexCode.c_str(), vertexCode.size() + 1);
+		hash = Hash(hash, fragmentCode.c_str(), fragmentCode.size() + 1);
+
+		const GLenum driverStrings[] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+
+		for (GLuint i = 0; i < 3; i++)
+		{
+			const char *value = (const char *)glGetString(driverStrings[i]);
+
+			if (value)
+			{
+				hash = Hash(hash, value, strlen(value) + 1);
+			}
+		}
+
+		return hash;
+	}
+
+	// Tries to link program from the cached binary, returns false on any kind of miss
+	static bool Load(GLuint program, const std::string &cachePath, uint64_t key)
+	{
+		std::ifstream in(cachePath.c_str(), std::ios::binary);
+		Header header;
+
+		if (!in || !in.read((char *)&header, sizeof(header)) || 0 != memcmp(header.magic, "GLPB", 4) || header.key != key)
+		{
+			return false;
+		}
+
+		std::vector<char> binary(header.length);
+
+		if (0 == header.length || !in.read(&binary[0], header.length))
+		{
+			return false;
+		}
+
+		glProgramBinary(program, header.format, &binary[0], header.length);
+
+		GLint success = 0;
+		glGetProgramiv(program, GL_LINK_STATUS, &success);
+
+		return 0 != success;
+	}
+
+	// Call after a successful link of a program created with GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+	static void Save(GLuint program, const std::string &cachePath, uint64_t key)
+	{
+		GLint length = 0;
+		glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+
+		if (length <= 0)
+		{
+			return;
+		}
+
+		Header header;
+		memcpy(header.magic, "GLPB", 4);
+		header.format = 0;
+		header.length = 0;
+		header.padding = 0;
+		header.key = key;
+
+		std::vector<char> binary(length);
+		GLsizei written = 0;
+		glGetProgramBinary(program, length, &written, &header.format, &binary[0]);
+		header.length = (GLuint)written;
+
+		std::ofstream out(cachePath.c_str(), std::ios::binary | std::ios::trunc);
+
+		if (!out)
+		{
+			std::cout << "WARNING::SHADER:: could not write program cache " << cachePath << std::endl;
+			return;
+		}
+
+		out.write((const char *)&header, sizeof(header));
+		out.write(&binary[0], written);
+	}
+
+private:
+	struct Header
+	{
+		char magic[4];
+		GLenum format;
+		GLuint length;
+		GLuint padding;
+		uint64_t key;
+	};
+
+	// FNV-1a, 64 bit
+	static uint64_t Hash(uint64_t hash, const char *data, size_t size)
+	{
+		for (size_t i = 0; i < size; i++)
+		{
+			hash = (hash ^ (unsigned char)data[i]) * 1099511628211ull;
+		}
+
+		return hash;
+	}
+};
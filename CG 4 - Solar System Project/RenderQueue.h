@@ -0,0 +1,79 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_inverse.hpp>
+
+#include "Shader.h"
+#include "Model.h"
+#include "StateTracker.h"
+
+using namespace std;
+
+// Collects draws during the frame and issues them sorted by state, most expensive change first: program, then
+// texture set, then VAO. Drawing goes through a StateTracker, so whatever consecutive items share is bound once.
+class RenderQueue
+{
+public:
+	// Queues every mesh of the model. The shader's per-frame uniforms (view, projection, ...) are expected to be set
+	// already, only the model and normal matrices are set per item.
+	void Submit(Shader &shader, Model &model, const glm::mat4 &transform)
+	{
+		vector<Mesh> &meshes = model.GetMeshes();
+		glm::mat3 normalMatrix = glm::inverseTranspose(glm::mat3(transform));
+
+		for (GLuint i = 0; i < meshes.size(); i++)
+		{
+			DrawItem item;
+			item.key = MakeKey(shader.Program, meshes[i].GetMaterialID(), meshes[i].GetVAO());
+			item.shader = &shader;
+			item.mesh = &meshes[i];
+			item.transform = transform;
+			item.normalMatrix = normalMatrix;
+			this->items.push_back(item);
+		}
+	}
+
+	// Sorts and draws everything queued, then empties the queue. The tracker is invalidated first, since other
+	// code may have changed the GL state since the last flush.
+	void Flush(StateTracker &state)
+	{
+		sort(this->items.begin(), this->items.end(), [](const DrawItem &a, const DrawItem &b) { return a.key < b.key; });
+
+		state.Invalidate();
+
+		for (GLuint i = 0; i < this->items.size(); i++)
+		{
+			const DrawItem &item = this->items[i];
+
+			state.UseProgram(item.shader->Program);
+			item.shader->setMat4("model", item.transform);
+			item.shader->setMat3("normalMatrix", item.normalMatrix);
+			item.mesh->Draw(*item.shader, state);
+		}
+
+		this->items.clear();
+	}
+
+	// Program in the top 16 bits, texture set in the next 24 and VAO in the low 24
+	static uint64_t MakeKey(GLuint program, GLuint material, GLuint vertexArray)
+	{
+		return ((uint64_t)(program & 0xffff) << 48) | ((uint64_t)(material & 0xffffff) << 24) | (uint64_t)(vertexArray & 0xffffff);
+	}
+
+private:
+	struct DrawItem
+	{
+		uint64_t key;
+		Shader *shader;
+		Mesh *mesh;
+		glm::mat4 transform;
+		glm::mat3 normalMatrix;
+	};
+
+	vector<DrawItem> items;
+};
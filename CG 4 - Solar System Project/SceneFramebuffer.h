@@ -0,0 +1,91 @@
+#pragma once
+
+#include <iostream>
+
+#include <GL/glew.h>
+
+// Offscreen colour and 32-bit float depth target the scene is drawn into, then copied to the window. The window's own
+// depth buffer is normally 24-bit fixed point, which would throw away most of what reverse-Z gains.
+class SceneFramebuffer
+{
+public:
+	SceneFramebuffer(GLsizei width, GLsizei height) : framebuffer(0), colorBuffer(0), depthBuffer(0), width(0), height(0), complete(false)
+	{
+		glGenFramebuffers(1, &this->framebuffer);
+		glGenRenderbuffers(1, &this->colorBuffer);
+		glGenRenderbuffers(1, &this->depthBuffer);
+
+		this->Resize(width, height);
+	}
+
+	~SceneFramebuffer()
+	{
+		glDeleteFramebuffers(1, &this->framebuffer);
+		glDeleteRenderbuffers(1, &this->colorBuffer);
+		glDeleteRenderbuffers(1, &this->depthBuffer);
+	}
+
+	// glClipControl is GL 4.5, or ARB_clip_control before that
+	static bool IsReverseZSupported()
+	{
+		return GL_FALSE != GLEW_VERSION_4_5 || GL_FALSE != GLEW_ARB_clip_control;
+	}
+
+	// Reallocates both buffers for the new size, the contents are lost
+	bool Resize(GLsizei width, GLsizei height)
+	{
+		this->width = width;
+		this->height = height;
+
+		glBindRenderbuffer(GL_RENDERBUFFER, this->colorBuffer);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+		glBindRenderbuffer(GL_RENDERBUFFER, this->depthBuffer);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT32F, width, height);
+		glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+		glBindFramebuffer(GL_FRAMEBUFFER, this->framebuffer);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, this->colorBuffer);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, this->depthBuffer);
+		GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+		if (GL_FRAMEBUFFER_COMPLETE != status)
+		{
+			std::cout << "ERROR::SCENE_FRAMEBUFFER::INCOMPLETE " << status << std::endl;
+			this->complete = false;
+			return false;
+		}
+
+		this->complete = true;
+		return true;
+	}
+
+	// Whether the last Resize (including the one in the constructor) left something that can be drawn into
+	bool IsComplete() const
+	{
+		return this->complete;
+	}
+
+	// Everything drawn from here on goes into the offscreen buffers
+	void Bind()
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, this->framebuffer);
+	}
+
+	// Copies the colour buffer to the window's framebuffer and leaves that bound
+	void BlitToScreen()
+	{
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, this->framebuffer);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+		glBlitFramebuffer(0, 0, this->width, this->height, 0, 0, this->width, this->height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	}
+
+private:
+	GLuint framebuffer, colorBuffer, depthBuffer;
+	GLsizei width, height;
+	bool complete;
+
+	SceneFramebuffer(const SceneFramebuffer &);
+	SceneFramebuffer &operator=(const SceneFramebuffer &);
+};
@@ -0,0 +1,329 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_inverse.hpp>
+
+#include "Shader.h"
+#include "Model.h"
+#include "GeometryArena.h"
+#include "MaterialPacker.h"
+
+using namespace std;
+
+// Vertex attribute carrying the index of the current draw into the per-draw storage buffer. It is fed from a buffer
+// holding 0, 1, 2, ... with a divisor of 1, so each indirect command selects its entry through its baseInstance.
+const GLuint DRAW_INDEX_ATTRIBUTE_LOCATION = 10;
+
+// Layout fixed by the GL spec for glMultiDrawElementsIndirect
+struct DrawElementsIndirectCommand
+{
+	GLuint count;
+	GLuint instanceCount;
+	GLuint firstIndex;
+	GLint baseVertex;
+	GLuint baseInstance;
+};
+
+// One entry of the per-draw shader storage buffer, std430 layout (see modelLoadingIndirectVertex.txt)
+struct DrawData
+{
+	glm::mat4 model;
+	// Only the upper 3x3 is used, stored as a mat4 to keep the std430 layout trivial
+	glm::mat4 normalMatrix;
+	// The material's region of the packed texture array, see MaterialSlot
+	glm::vec4 uvTransform;
+	GLuint material;
+	GLuint layer;
+	GLuint padding[2];
+};
+
+// Collects every opaque mesh of the frame and submits them in bulk. Meshes have to live in the renderer's
+// GeometryArena, so they all share one VAO.
+//  - GL 4.3: the draws are sorted by material, their transforms go into a shader storage buffer and their ranges into
+//    an indirect command buffer, and each material's draws go out in one glMultiDrawElementsIndirect call.
+//  - GL 3.3: the same sorted list is drawn with one glDrawElementsBaseVertex per mesh and uniform transforms.
+// Textures are bound per material, so with one texture per planet there is one call per planet texture. Once a
+// MaterialPacker is set (indirect path only) every draw finds its texture in the packed array through its storage
+// buffer entry, and the whole scene goes out in a single call with a single texture binding.
+class SceneRenderer
+{
+public:
+	SceneRenderer(GeometryArena &arena) : arena(arena), indirect(IsIndirectSupported()), commandBuffer(0), drawBuffer(0), drawIndexBuffer(0),
+		drawIndexCapacity(0), drawIndexAttached(false), materials(nullptr), lastCallCount(0)
+	{
+		if (this->indirect)
+		{
+			glGenBuffers(1, &this->commandBuffer);
+			glGenBuffers(1, &this->drawBuffer);
+			glGenBuffers(1, &this->drawIndexBuffer);
+		}
+	}
+
+	~SceneRenderer()
+	{
+		if (this->indirect)
+		{
+			glDeleteBuffers(1, &this->commandBuffer);
+			glDeleteBuffers(1, &this->drawBuffer);
+			glDeleteBuffers(1, &this->drawIndexBuffer);
+		}
+	}
+
+	// Multi-draw indirect needs GL 4.3 (indirect commands with baseInstance, shader storage buffers)
+	static bool IsIndirectSupported()
+	{
+		return GL_FALSE != GLEW_VERSION_4_3;
+	}
+
+	bool IsIndirect() const
+	{
+		return this->indirect;
+	}
+
+	// Samples every material from the packer's array from now on. Every material submitted must have been added to
+	// it, nullptr goes back to binding textures per material.
+	void SetMaterials(const MaterialPacker *packer)
+	{
+		this->materials = packer;
+	}
+
+	// True when Draw needs the array shader (modelLoadingArrayFrag.txt)
+	bool IsUsingMaterialArray() const
+	{
+		return this->indirect && this->materials && this->materials->IsPacked();
+	}
+
+	// Queues every mesh of the model with the given transform, nothing is drawn until Draw
+	void Submit(Model &model, const glm::mat4 &transform)
+	{
+		vector<Mesh> &meshes = model.GetMeshes();
+		glm::mat4 normalMatrix = glm::mat4(glm::inverseTranspose(glm::mat3(transform)));
+
+		for (GLuint i = 0; i < meshes.size(); i++)
+		{
+			// Only meshes in our arena can share the VAO
+			if (meshes[i].GetArena() != &this->arena)
+			{
+				continue;
+			}
+
+			QueuedDraw draw;
+			draw.mesh = &meshes[i];
+			draw.material = meshes[i].GetMaterialID();
+			draw.transform = transform;
+			draw.normalMatrix = normalMatrix;
+			this->queue.push_back(draw);
+		}
+	}
+
+	// Draws everything submitted since the last call. The shader must be in use: modelLoadingIndirectVertex.txt on
+	// the indirect path (with modelLoadingArrayFrag.txt while IsUsingMaterialArray), modelLoadingVertex.txt
+	// (model/normalMatrix uniforms) on the fallback.
+	void Draw(Shader &shader)
+	{
+		// Group draws by material so textures are bound once per group (std::sort, unlike stable_sort, never allocates).
+		// Nothing to group when they all come from the array.
+		if (!this->IsUsingMaterialArray())
+		{
+			sort(this->queue.begin(), this->queue.end(), [](const QueuedDraw &a, const QueuedDraw &b) { return a.material < b.material; });
+		}
+
+		this->lastCallCount = 0;
+		this->arena.Bind();
+
+		if (this->indirect)
+		{
+			this->drawIndirect(shader);
+		}
+		else
+		{
+			this->drawDirect(shader);
+		}
+
+		this->queue.clear();
+	}
+
+	// Draw calls issued by the last Draw
+	GLuint GetLastCallCount() const
+	{
+		return this->lastCallCount;
+	}
+
+private:
+	struct QueuedDraw
+	{
+		Mesh *mesh;
+		GLuint material;
+		glm::mat4 transform;
+		glm::mat4 normalMatrix;
+	};
+
+	GeometryArena &arena;
+	bool indirect;
+	vector<QueuedDraw> queue;
+
+	GLuint commandBuffer, drawBuffer, drawIndexBuffer;
+	GLsizei drawIndexCapacity;
+	bool drawIndexAttached;
+	vector<DrawElementsIndirectCommand> commands;
+	vector<DrawData> drawData;
+
+	const MaterialPacker *materials;
+	GLuint lastCallCount;
+
+	void drawIndirect(Shader &shader)
+	{
+		GLsizei drawCount = (GLsizei)this->queue.size();
+
+		if (0 == drawCount)
+		{
+			return;
+		}
+
+		this->commands.resize(drawCount);
+		this->drawData.resize(drawCount);
+
+		for (GLsizei i = 0; i < drawCount; i++)
+		{
+			const QueuedDraw &draw = this->queue[i];
+			const GeometryRange &range = draw.mesh->GetRange();
+
+			DrawElementsIndirectCommand &command = this->commands[i];
+			command.count = range.indexCount;
+			command.instanceCount = 1;
+			command.firstIndex = range.firstIndex;
+			command.baseVertex = range.baseVertex;
+			command.baseInstance = i;
+
+			this->drawData[i].model = draw.transform;
+			this->drawData[i].normalMatrix = draw.normalMatrix;
+			this->drawData[i].material = draw.material;
+
+			const MaterialSlot &slot = this->materials ? this->materials->GetSlot(draw.material) : MaterialPacker::GetUnpackedSlot();
+			this->drawData[i].uvTransform = slot.uvTransform;
+			this->drawData[i].layer = (GLuint)max(0, slot.layer);
+		}
+
+		// Orphan and refill both buffers, last frame's draws may still be reading them
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, this->commandBuffer);
+		glBufferData(GL_DRAW_INDIRECT_BUFFER, drawCount * sizeof(DrawElementsIndirectCommand), &this->commands[0], GL_STREAM_DRAW);
+
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, this->drawBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, drawCount * sizeof(DrawData), &this->drawData[0], GL_STREAM_DRAW);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, this->drawBuffer);
+
+		this->ensureDrawIndices(drawCount);
+
+		if (this->IsUsingMaterialArray())
+		{
+			glActiveTexture(GL_TEXTURE0);
+			glBindTexture(GL_TEXTURE_2D_ARRAY, this->materials->GetTexture());
+			glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (GLvoid *)0, drawCount, 0);
+			glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+			this->lastCallCount++;
+			this->detachDrawIndices();
+			return;
+		}
+
+		// One multi-draw per run of draws sharing a material
+		for (GLsizei first = 0; first < drawCount;)
+		{
+			GLsizei last = first + 1;
+
+			while (last < drawCount && this->queue[last].material == this->queue[first].material)
+			{
+				last++;
+			}
+
+			this->queue[first].mesh->BindTextures(shader);
+			glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (GLvoid *)(first * sizeof(DrawElementsIndirectCommand)), last - first, 0);
+			this->queue[first].mesh->UnbindTextures();
+
+			this->lastCallCount++;
+			first = last;
+		}
+
+		this->detachDrawIndices();
+	}
+
+	void drawDirect(Shader &shader)
+	{
+		GLuint boundMaterial = ~0u;
+		Mesh *boundMesh = nullptr;
+
+		for (GLuint i = 0; i < this->queue.size(); i++)
+		{
+			const QueuedDraw &draw = this->queue[i];
+
+			if (draw.material != boundMaterial)
+			{
+				if (boundMesh)
+				{
+					boundMesh->UnbindTextures();
+				}
+
+				draw.mesh->BindTextures(shader);
+				boundMaterial = draw.material;
+				boundMesh = draw.mesh;
+			}
+
+			shader.setMat4("model", draw.transform);
+			shader.setMat3("normalMatrix", glm::mat3(draw.normalMatrix));
+			this->arena.Draw(draw.mesh->GetRange());
+			this->lastCallCount++;
+		}
+
+		if (boundMesh)
+		{
+			boundMesh->UnbindTextures();
+		}
+	}
+
+	// Makes sure the draw index buffer holds at least 0 .. count - 1 and is hooked up to the arena's VAO (bound).
+	// The attribute is only enabled for the multi-draw, plain draws through the shared VAO don't read it. Instanced
+	// draws use the arena's other VAO, see GeometryArena::BindInstanced.
+	void ensureDrawIndices(GLsizei count)
+	{
+		if (count > this->drawIndexCapacity)
+		{
+			this->drawIndexCapacity = max(count, this->drawIndexCapacity * 2);
+			vector<GLuint> indices(this->drawIndexCapacity);
+
+			for (GLsizei i = 0; i < this->drawIndexCapacity; i++)
+			{
+				indices[i] = i;
+			}
+
+			glBindBuffer(GL_ARRAY_BUFFER, this->drawIndexBuffer);
+			glBufferData(GL_ARRAY_BUFFER, indices.size() * sizeof(GLuint), &indices[0], GL_STATIC_DRAW);
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
+		}
+
+		if (!this->drawIndexAttached)
+		{
+			glBindBuffer(GL_ARRAY_BUFFER, this->drawIndexBuffer);
+			glVertexAttribIPointer(DRAW_INDEX_ATTRIBUTE_LOCATION, 1, GL_UNSIGNED_INT, sizeof(GLuint), (GLvoid *)0);
+			glVertexAttribDivisor(DRAW_INDEX_ATTRIBUTE_LOCATION, 1);
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
+			this->drawIndexAttached = true;
+		}
+
+		glEnableVertexAttribArray(DRAW_INDEX_ATTRIBUTE_LOCATION);
+	}
+
+	// Undoes the per-draw state ensureDrawIndices left on the arena's VAO (bound)
+	void detachDrawIndices()
+	{
+		glDisableVertexAttribArray(DRAW_INDEX_ATTRIBUTE_LOCATION);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	}
+
+	SceneRenderer(const SceneRenderer &);
+	SceneRenderer &operator=(const SceneRenderer &);
+};
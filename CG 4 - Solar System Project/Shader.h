@@ -5,8 +5,14 @@
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <vector>
+#include <memory>
 
 #include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "ProgramBinaryCache.h"
 
 class Shader
 {
@@ -45,7 +51,79 @@ public:
 		}
 		const GLchar *vShaderCode = vertexCode.c_str();
 		const GLchar *fShaderCode = fragmentCode.c_str();
-		// 2. Compile shaders
+		// 2. Try the program binary cache first, a warm start then skips compiling entirely
+		bool binaryCache = ProgramBinaryCache::IsSupported();
+		std::string cachePath = GetProgramCachePath(vertexPath, fragmentPath);
+		uint64_t cacheKey = ProgramBinaryCache::MakeKey(vertexCode, fragmentCode);
+
+		this->Program = glCreateProgram();
+
+		if (!binaryCache || !ProgramBinaryCache::Load(this->Program, cachePath, cacheKey))
+		{
+			// 3. Compile from source, then store the result for next time
+			if (this->compile(vShaderCode, fShaderCode, binaryCache) && binaryCache)
+			{
+				ProgramBinaryCache::Save(this->Program, cachePath, cacheKey);
+			}
+		}
+
+		// Look up every active uniform once, so the setters never have to ask GL
+		this->uniforms.reset(new UniformTable(this->Program));
+	}
+	// Uses the current shader
+	void Use()
+	{
+		glUseProgram(this->Program);
+	}
+
+	// Location of a uniform from the cache, -1 if the program has no such uniform
+	GLint GetUniformLocation(const GLchar *name) const
+	{
+		return this->uniforms->Find(this->Program, name);
+	}
+
+	// Typed setters, all go through the uniform cache. The program must be in use.
+	void setInt(const GLchar *name, GLint value) const
+	{
+		glUniform1i(this->GetUniformLocation(name), value);
+	}
+
+	void setFloat(const GLchar *name, GLfloat value) const
+	{
+		glUniform1f(this->GetUniformLocation(name), value);
+	}
+
+	void setVec3(const GLchar *name, const glm::vec3 &value) const
+	{
+		glUniform3f(this->GetUniformLocation(name), value.x, value.y, value.z);
+	}
+
+	void setVec3(const GLchar *name, GLfloat x, GLfloat y, GLfloat z) const
+	{
+		glUniform3f(this->GetUniformLocation(name), x, y, z);
+	}
+
+	void setMat3(const GLchar *name, const glm::mat3 &value) const
+	{
+		glUniformMatrix3fv(this->GetUniformLocation(name), 1, GL_FALSE, glm::value_ptr(value));
+	}
+
+	void setMat4(const GLchar *name, const glm::mat4 &value) const
+	{
+		glUniformMatrix4fv(this->GetUniformLocation(name), 1, GL_FALSE, glm::value_ptr(value));
+	}
+
+	// Number of lookups for names that weren't among the program's active uniforms (typos, or uniforms the compiler
+	// optimised out). Each such name costs one glGetUniformLocation, after which it is cached too.
+	GLuint GetUniformCacheMisses() const
+	{
+		return this->uniforms->misses;
+	}
+
+private:
+	// Compiles both shaders and links them into Program, returns whether linking worked
+	bool compile(const GLchar *vShaderCode, const GLchar *fShaderCode, bool retrievable)
+	{
 		GLuint vertex, fragment;
 		GLint success;
 		GLchar infoLog[512];
@@ -72,9 +150,14 @@ public:
 			std::cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n" << infoLog << std::endl;
 		}
 		// Shader Program
-		this->Program = glCreateProgram();
 		glAttachShader(this->Program, vertex);
 		glAttachShader(this->Program, fragment);
+
+		if (retrievable)
+		{
+			glProgramParameteri(this->Program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+		}
+
 		glLinkProgram(this->Program);
 		// Print linking errors if any
 		glGetProgramiv(this->Program, GL_LINK_STATUS, &success);
@@ -87,12 +170,161 @@ public:
 		glDeleteShader(vertex);
 		glDeleteShader(fragment);
 
+		return 0 != success;
 	}
-	// Uses the current shader
-	void Use()
+
+	// The cache file lives next to the vertex shader and is named after both shader files, e.g. "a+b.progcache"
+	static std::string GetProgramCachePath(const std::string &vertexPath, const std::string &fragmentPath)
 	{
-		glUseProgram(this->Program);
+		std::string directory = vertexPath.substr(0, vertexPath.find_last_of("/\\") + 1);
+
+		return directory + GetStem(vertexPath) + "+" + GetStem(fragmentPath) + ".progcache";
 	}
+
+	static std::string GetStem(const std::string &path)
+	{
+		std::string name = path.substr(path.find_last_of("/\\") + 1);
+
+		return name.substr(0, name.find_last_of('.'));
+	}
+
+	// Open addressing hash table from uniform name to location, filled from the program's active uniforms after linking
+	struct UniformTable
+	{
+		struct Slot
+		{
+			GLuint hash;
+			GLint location;
+			std::string name;
+		};
+
+		std::vector<Slot> slots;
+		GLuint count;
+		GLuint misses;
+
+		UniformTable(GLuint program) : count(0), misses(0)
+		{
+			GLint activeUniforms = 0;
+			GLint maxNameLength = 0;
+			glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &activeUniforms);
+			glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxNameLength);
+
+			GLuint capacity = 16;
+
+			while (capacity < (GLuint)activeUniforms * 2)
+			{
+				capacity *= 2;
+			}
+
+			this->slots.resize(capacity);
+
+			for (GLuint i = 0; i < capacity; i++)
+			{
+				this->slots[i].location = -1;
+				this->slots[i].hash = 0;
+			}
+
+			std::vector<GLchar> name(maxNameLength + 1);
+
+			for (GLint i = 0; i < activeUniforms; i++)
+			{
+				GLint size;
+				GLenum type;
+				glGetActiveUniform(program, i, (GLsizei)name.size(), NULL, &size, &type, &name[0]);
+
+				std::string uniformName(&name[0]);
+				GLint location = glGetUniformLocation(program, uniformName.c_str());
+				this->Insert(uniformName, location);
+
+				// Arrays are reported as "name[0]", make the plain name work as well
+				if (uniformName.size() > 3 && 0 == uniformName.compare(uniformName.size() - 3, 3, "[0]"))
+				{
+					this->Insert(uniformName.substr(0, uniformName.size() - 3), location);
+				}
+			}
+		}
+
+		// FNV-1a
+		static GLuint Hash(const GLchar *name)
+		{
+			GLuint hash = 2166136261u;
+
+			for (; *name; name++)
+			{
+				hash = (hash ^ (GLubyte)*name) * 16777619u;
+			}
+
+			return hash;
+		}
+
+		GLint Find(GLuint program, const GLchar *name)
+		{
+			GLuint hash = Hash(name);
+			GLuint mask = (GLuint)this->slots.size() - 1;
+
+			for (GLuint i = hash & mask; !this->slots[i].name.empty(); i = (i + 1) & mask)
+			{
+				if (this->slots[i].hash == hash && this->slots[i].name == name)
+				{
+					return this->slots[i].location;
+				}
+			}
+
+			// Not an active uniform, ask GL once and remember the answer
+			this->misses++;
+			GLint location = glGetUniformLocation(program, name);
+			this->Insert(name, location);
+
+			return location;
+		}
+
+		void Insert(const std::string &name, GLint location)
+		{
+			// Keep the table at most half full
+			if ((this->count + 1) * 2 > this->slots.size())
+			{
+				std::vector<Slot> old;
+				old.swap(this->slots);
+				this->slots.resize(old.size() * 2);
+				this->count = 0;
+
+				for (GLuint i = 0; i < this->slots.size(); i++)
+				{
+					this->slots[i].location = -1;
+					this->slots[i].hash = 0;
+				}
+
+				for (GLuint i = 0; i < old.size(); i++)
+				{
+					if (!old[i].name.empty())
+					{
+						this->Insert(old[i].name, old[i].location);
+					}
+				}
+			}
+
+			GLuint hash = Hash(name.c_str());
+			GLuint mask = (GLuint)this->slots.size() - 1;
+			GLuint i = hash & mask;
+
+			while (!this->slots[i].name.empty())
+			{
+				i = (i + 1) & mask;
+			}
+
+			this->slots[i].hash = hash;
+			this->slots[i].location = location;
+			this->slots[i].name = name;
+			this->count++;
+		}
+	};
+
+	// Held by pointer so the const setters can fill in misses
+	std::unique_ptr<UniformTable> uniforms;
+
+	// Shaders are passed around by reference, a copy would only duplicate the uniform cache of the same program
+	Shader(const Shader &);
+	Shader &operator=(const Shader &);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,8 @@
+#pragma once
+
+// SSE2 is part of every x86-64 target. Code with an SSE2 path checks SOLAR_SSE2, define SOLAR_NO_SIMD to force the
+// scalar fallbacks everywhere.
+#if !defined(SOLAR_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define SOLAR_SSE2
+#include <emmintrin.h>
+#endif
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <GL/glew.h>
+
+// Texture units the tracker keeps shadow state for, binds to higher units always go through
+const GLuint TRACKED_TEXTURE_UNITS = 16;
+
+// Shadows the bits of GL state the draw loop changes most (program, VAO, active texture unit, 2D texture per unit)
+// and skips calls that wouldn't change anything. Anything that changes this state behind its back has to be followed
+// by Invalidate(). Counts issued and skipped state changes until ResetCounters().
+class StateTracker
+{
+public:
+	StateTracker() : issued(0), skipped(0)
+	{
+		this->Invalidate();
+	}
+
+	// Forget everything, the next call of each kind will be issued
+	void Invalidate()
+	{
+		this->program = INVALID;
+		this->vertexArray = INVALID;
+		this->activeUnit = INVALID;
+
+		for (GLuint i = 0; i < TRACKED_TEXTURE_UNITS; i++)
+		{
+			this->textures[i] = INVALID;
+		}
+	}
+
+	void UseProgram(GLuint program)
+	{
+		if (this->program == program)
+		{
+			this->skipped++;
+			return;
+		}
+
+		glUseProgram(program);
+		this->program = program;
+		this->issued++;
+	}
+
+	void BindVertexArray(GLuint vertexArray)
+	{
+		if (this->vertexArray == vertexArray)
+		{
+			this->skipped++;
+			return;
+		}
+
+		glBindVertexArray(vertexArray);
+		this->vertexArray = vertexArray;
+		this->issued++;
+	}
+
+	void BindTexture2D(GLuint unit, GLuint texture)
+	{
+		if (unit < TRACKED_TEXTURE_UNITS && this->textures[unit] == texture)
+		{
+			this->skipped++;
+			return;
+		}
+
+		this->activeTexture(unit);
+		glBindTexture(GL_TEXTURE_2D, texture);
+		this->issued++;
+
+		if (unit < TRACKED_TEXTURE_UNITS)
+		{
+			this->textures[unit] = texture;
+		}
+	}
+
+	GLuint GetIssued() const
+	{
+		return this->issued;
+	}
+
+	GLuint GetSkipped() const
+	{
+		return this->skipped;
+	}
+
+	void ResetCounters()
+	{
+		this->issued = 0;
+		this->skipped = 0;
+	}
+
+private:
+	// Never a valid GL name, so the first call after Invalidate() always goes through
+	static const GLuint INVALID = ~0u;
+
+	GLuint program;
+	GLuint vertexArray;
+	GLuint activeUnit;
+	GLuint textures[TRACKED_TEXTURE_UNITS];
+
+	GLuint issued;
+	GLuint skipped;
+
+	void activeTexture(GLuint unit)
+	{
+		if (this->activeUnit == unit)
+		{
+			this->skipped++;
+			return;
+		}
+
+		glActiveTexture(GL_TEXTURE0 + unit);
+		this->activeUnit = unit;
+		this->issued++;
+	}
+};
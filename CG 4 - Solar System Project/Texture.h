@@ -3,7 +3,16 @@
 #define GLEW_STATIC
 #include <GL/glew.h>
 
+#include <string>
 #include <vector>
+#include <future>
+#include <chrono>
+#include <iostream>
+
+#include "ImageData.h"
+#include "ThreadPool.h"
+#include "MipChain.h"
+#include "TextureCache.h"
 
 
 class TextureLoading
@@ -30,48 +39,110 @@ public:
 		return textureID;
 	}
 
-	static GLuint LoadCubemap(vector<const GLchar * > faces)
+	// Loads the six faces with full mip chains, so the starfield doesn't shimmer when minified. BC1 through the
+	// TextureCache where supported (only the first run decodes the .tga files), RGB8 with a CPU built chain otherwise.
+	// With a pool the faces are read in parallel, and any chains still to build are split across its workers.
+	static GLuint LoadCubemap(vector<const GLchar * > faces, ThreadPool *pool = nullptr)
 	{
-		GLuint textureID;
-		glGenTextures(1, &textureID);
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
 
-		int imageWidth, imageHeight;
-		unsigned char *image;
+		struct Face
+		{
+			bool isCompressed = false;
+			CompressedImage compressed;
+			ImageData image;
+		};
 
-		glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
+		bool compress = TextureCache::IsSupported();
+		auto loadFace = [compress](string path)
+		{
+			Face face;
+			bool transcoded;
+			face.isCompressed = compress && TextureCache::Get(path, face.compressed, transcoded);
+
+			if (!face.isCompressed)
+			{
+				face.image = LoadImageData(path.c_str(), ".");
+			}
+
+			return face;
+		};
+
+		vector<Face> loaded(faces.size());
+		vector<future<Face>> pending;
 
 		for (GLuint i = 0; i < faces.size(); i++)
 		{
-			image = SOIL_load_image(faces[i], &imageWidth, &imageHeight, 0, SOIL_LOAD_RGB);
-			glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, imageWidth, imageHeight, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
-			SOIL_free_image_data(image);
+			if (pool)
+			{
+				string path = faces[i];
+				pending.push_back(pool->Enqueue([loadFace, path]() { return loadFace(path); }));
+			}
+			else
+			{
+				loaded[i] = loadFace(faces[i]);
+			}
+		}
+
+		for (GLuint i = 0; i < pending.size(); i++)
+		{
+			loaded[i] = pending[i].get();
 		}
+
+		GLuint textureID;
+		glGenTextures(1, &textureID);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
+
+		size_t bytes = 0, uncompressedBytes = 0;
+		// Shortest chain of any face, the cube map is only complete up to there
+		size_t levelCount = ~(size_t)0;
+
+		for (GLuint i = 0; i < loaded.size(); i++)
+		{
+			if (loaded[i].isCompressed)
+			{
+				TextureCache::Upload(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, loaded[i].compressed);
+				bytes += loaded[i].compressed.GetBytes();
+				uncompressedBytes += loaded[i].compressed.GetUncompressedBytes();
+				levelCount = min(levelCount, loaded[i].compressed.levels.size());
+				continue;
+			}
+
+			vector<ImageData> levels = MipChain::Generate(loaded[i].image, pool);
+			MipChain::Upload(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, levels);
+			levelCount = min(levelCount, levels.size());
+
+			for (GLuint j = 0; j < levels.size(); j++)
+			{
+				bytes += (size_t)levels[j].width * levels[j].height * 3;
+				uncompressedBytes += (size_t)levels[j].width * levels[j].height * 3;
+			}
+		}
+
 		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_BASE_LEVEL, 0);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, loaded.empty() || 0 == levelCount ? 0 : (GLint)levelCount - 1);
 		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
 		glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
 
+		cout << "Loaded cube map in " << chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() << " ms, " << bytes / 1024 << " KB ("
+			<< uncompressedBytes / 1024 << " KB as RGB8)" << endl;
+
 		return textureID;
 	}
 
 	GLint TextureFromFile(const GLchar *path)
 	{
 		//Generate texture ID and load texture data
-		string filename = string(path);
-		//filename = directory + '/' + filename;
 		GLuint textureID;
 		glGenTextures(1, &textureID);
 
-		int width, height;
-
-		unsigned char *image = SOIL_load_image(filename.c_str(), &width, &height, 0, SOIL_LOAD_RGB);
-
-		// Assign texture to ID
+		// Assign texture to ID, with the mip chain built on the CPU
 		glBindTexture(GL_TEXTURE_2D, textureID);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
-		glGenerateMipmap(GL_TEXTURE_2D);
+		MipChain::Upload(GL_TEXTURE_2D, MipChain::Generate(LoadImageData(path, ".")));
 
 		// Parameters
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
@@ -79,7 +150,6 @@ public:
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 		glBindTexture(GL_TEXTURE_2D, 0);
-		SOIL_free_image_data(image);
 
 		return textureID;
 	}
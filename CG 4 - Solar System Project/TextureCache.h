@@ -0,0 +1,498 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <GL/glew.h>
+
+#include "ImageData.h"
+#include "MipChain.h"
+
+using namespace std;
+
+// Bump this whenever the encoder changes so old files get transcoded again
+const uint32_t TEXTURE_CACHE_VERSION = 2;
+
+// A BC1 (DXT1) compressed image with its full mip chain, level 0 first. 4 bits per pixel instead of RGB8's 24.
+struct CompressedImage
+{
+	GLenum format = GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+	int width = 0;
+	int height = 0;
+	vector<vector<unsigned char>> levels;
+
+	size_t GetBytes() const
+	{
+		size_t bytes = 0;
+
+		for (size_t i = 0; i < this->levels.size(); i++)
+		{
+			bytes += this->levels[i].size();
+		}
+
+		return bytes;
+	}
+
+	// What the same mip chain takes as uncompressed RGB8, for comparison
+	size_t GetUncompressedBytes() const
+	{
+		size_t bytes = 0;
+
+		for (size_t i = 0; i < this->levels.size(); i++)
+		{
+			bytes += (size_t)max(1, this->width >> i) * max(1, this->height >> i) * 3;
+		}
+
+		return bytes;
+	}
+};
+
+// First-run transcoding of image files to BC1, stored next to the source as "<image>.ktx" (KTX 1.1, one face, full
+// mip chain). Later runs read the KTX file and upload it with glCompressedTexImage2D, skipping both the image decode
+// and the driver's own conversion. A key/value entry records the encoder version and the source's size and
+// modification time, so editing the image silently transcodes it again.
+// Everything except Upload is plain CPU work and may run on a worker thread.
+class TextureCache
+{
+public:
+	// S3TC is an extension on desktop GL, but practically universal
+	static bool IsSupported()
+	{
+		return GL_FALSE != GLEW_EXT_texture_compression_s3tc;
+	}
+
+	static string GetCachePath(const string &imagePath)
+	{
+		return imagePath + ".ktx";
+	}
+
+	// Reads the KTX file for the image, or transcodes the image and writes it. transcoded tells which happened.
+	// Returns false if neither worked (the source can't be read).
+	static bool Get(const string &imagePath, CompressedImage &image, bool &transcoded)
+	{
+		transcoded = false;
+
+		if (Load(imagePath, image))
+		{
+			return true;
+		}
+
+		size_t slash = imagePath.find_last_of("/\\");
+		string directory = (string::npos == slash) ? "." : imagePath.substr(0, slash);
+		string name = imagePath.substr(string::npos == slash ? 0 : slash + 1);
+		ImageData decoded = LoadImageData(name.c_str(), directory);
+
+		if (!decoded.pixels)
+		{
+			return false;
+		}
+
+		image = Compress(decoded);
+		Save(imagePath, image);
+		transcoded = true;
+
+		return true;
+	}
+
+	// Returns false on a miss (no file, stale file or corrupt file)
+	static bool Load(const string &imagePath, CompressedImage &image)
+	{
+		SourceStamp expected;
+
+		if (!MakeStamp(imagePath, expected))
+		{
+			return false;
+		}
+
+		ifstream in(GetCachePath(imagePath).c_str(), ios::binary);
+		Header header;
+
+		if (!in || !in.read((char *)&header, sizeof(header)) || 0 != memcmp(header.identifier, IDENTIFIER, sizeof(IDENTIFIER)) ||
+			ENDIANNESS != header.endianness || GL_COMPRESSED_RGB_S3TC_DXT1_EXT != header.glInternalFormat || 1 != header.numberOfFaces ||
+			header.bytesOfKeyValueData > 1024)
+		{
+			return false;
+		}
+
+		// Only full chains are ever written, anything else would leave the texture incomplete under mipmapped filtering
+		if (0 == header.pixelWidth || 0 == header.pixelHeight || header.pixelWidth > MAX_SIZE || header.pixelHeight > MAX_SIZE ||
+			header.numberOfMipmapLevels != GetLevelCount(header.pixelWidth, header.pixelHeight))
+		{
+			return false;
+		}
+
+		// The only key/value pair we write is the source stamp
+		vector<char> keyValueData(header.bytesOfKeyValueData);
+		uint32_t keyAndValueByteSize;
+
+		if (header.bytesOfKeyValueData < sizeof(keyAndValueByteSize) + sizeof(STAMP_KEY) + sizeof(SourceStamp) || !in.read(&keyValueData[0], keyValueData.size()))
+		{
+			return false;
+		}
+
+		memcpy(&keyAndValueByteSize, &keyValueData[0], sizeof(keyAndValueByteSize));
+
+		if (keyAndValueByteSize != sizeof(STAMP_KEY) + sizeof(SourceStamp) || 0 != memcmp(&keyValueData[4], STAMP_KEY, sizeof(STAMP_KEY)) ||
+			0 != memcmp(&keyValueData[4 + sizeof(STAMP_KEY)], &expected, sizeof(expected)))
+		{
+			return false;
+		}
+
+		CompressedImage loaded;
+		loaded.width = header.pixelWidth;
+		loaded.height = header.pixelHeight;
+		loaded.levels.resize(header.numberOfMipmapLevels);
+
+		for (uint32_t i = 0; i < header.numberOfMipmapLevels; i++)
+		{
+			uint32_t imageSize;
+
+			if (!in.read((char *)&imageSize, sizeof(imageSize)) || imageSize != GetLevelSize(loaded.width, loaded.height, i))
+			{
+				return false;
+			}
+
+			loaded.levels[i].resize(imageSize);
+
+			if (!in.read((char *)&loaded.levels[i][0], imageSize))
+			{
+				return false;
+			}
+		}
+
+		image = move(loaded);
+
+		return true;
+	}
+
+	static void Save(const string &imagePath, const CompressedImage &image)
+	{
+		SourceStamp stamp;
+
+		if (!MakeStamp(imagePath, stamp))
+		{
+			return;
+		}
+
+		ofstream out(GetCachePath(imagePath).c_str(), ios::binary | ios::trunc);
+
+		if (!out)
+		{
+			cout << "WARNING::TEXTURE_CACHE:: could not write " << GetCachePath(imagePath) << endl;
+			return;
+		}
+
+		uint32_t keyAndValueByteSize = sizeof(STAMP_KEY) + sizeof(SourceStamp);
+
+		Header header;
+		memcpy(header.identifier, IDENTIFIER, sizeof(IDENTIFIER));
+		header.endianness = ENDIANNESS;
+		header.glType = 0;
+		header.glTypeSize = 1;
+		header.glFormat = 0;
+		header.glInternalFormat = image.format;
+		header.glBaseInternalFormat = GL_RGB;
+		header.pixelWidth = image.width;
+		header.pixelHeight = image.height;
+		header.pixelDepth = 0;
+		header.numberOfArrayElements = 0;
+		header.numberOfFaces = 1;
+		header.numberOfMipmapLevels = (uint32_t)image.levels.size();
+		// Each pair is padded to 4 bytes
+		header.bytesOfKeyValueData = sizeof(keyAndValueByteSize) + ((keyAndValueByteSize + 3) & ~3u);
+
+		const char padding[4] = { 0, 0, 0, 0 };
+		out.write((const char *)&header, sizeof(header));
+		out.write((const char *)&keyAndValueByteSize, sizeof(keyAndValueByteSize));
+		out.write(STAMP_KEY, sizeof(STAMP_KEY));
+		out.write((const char *)&stamp, sizeof(stamp));
+		out.write(padding, ((keyAndValueByteSize + 3) & ~3u) - keyAndValueByteSize);
+
+		// BC1 levels are whole 8 byte blocks, so no mip padding is ever needed
+		for (size_t i = 0; i < image.levels.size(); i++)
+		{
+			uint32_t imageSize = (uint32_t)image.levels[i].size();
+			out.write((const char *)&imageSize, sizeof(imageSize));
+			out.write((const char *)&image.levels[i][0], imageSize);
+		}
+	}
+
+	// Builds the mip chain (see MipChain) and encodes every level to BC1
+	static CompressedImage Compress(const ImageData &image, ThreadPool *pool = nullptr)
+	{
+		CompressedImage compressed;
+		compressed.width = image.width;
+		compressed.height = image.height;
+
+		vector<ImageData> levels = MipChain::Generate(image, pool);
+
+		for (size_t i = 0; i < levels.size(); i++)
+		{
+			compressed.levels.push_back(CompressLevel(levels[i]));
+		}
+
+		return compressed;
+	}
+
+	// Uploads every level to the bound texture's target (GL_TEXTURE_2D or a cube map face)
+	static void Upload(GLenum target, const CompressedImage &image)
+	{
+		for (size_t i = 0; i < image.levels.size(); i++)
+		{
+			glCompressedTexImage2D(target, (GLint)i, image.format, max(1, image.width >> i), max(1, image.height >> i), 0,
+				(GLsizei)image.levels[i].size(), &image.levels[i][0]);
+		}
+	}
+
+	// Levels in a full mip chain down to 1x1
+	static uint32_t GetLevelCount(int width, int height)
+	{
+		uint32_t levels = 1;
+
+		for (int size = max(width, height); size > 1; size >>= 1)
+		{
+			levels++;
+		}
+
+		return levels;
+	}
+
+	// Bytes of BC1 data for the given mip level, 8 per 4x4 block
+	static uint32_t GetLevelSize(int width, int height, int level)
+	{
+		uint32_t blocksX = (max(1, width >> level) + 3) / 4;
+		uint32_t blocksY = (max(1, height >> level) + 3) / 4;
+
+		return blocksX * blocksY * 8;
+	}
+
+private:
+	// Largest side a cache file may claim, far beyond any texture GL accepts, so a corrupt size can't ask for gigabytes
+	static const uint32_t MAX_SIZE = 1 << 16;
+
+	// KTX 1.1 file header, see the Khronos KTX specification
+	struct Header
+	{
+		unsigned char identifier[12];
+		uint32_t endianness;
+		uint32_t glType;
+		uint32_t glTypeSize;
+		uint32_t glFormat;
+		uint32_t glInternalFormat;
+		uint32_t glBaseInternalFormat;
+		uint32_t pixelWidth;
+		uint32_t pixelHeight;
+		uint32_t pixelDepth;
+		uint32_t numberOfArrayElements;
+		uint32_t numberOfFaces;
+		uint32_t numberOfMipmapLevels;
+		uint32_t bytesOfKeyValueData;
+	};
+
+	struct SourceStamp
+	{
+		uint32_t version;
+		uint32_t padding;
+		uint64_t sourceSize;
+		int64_t sourceTime;
+	};
+
+	static const unsigned char IDENTIFIER[12];
+	static const uint32_t ENDIANNESS = 0x04030201;
+	static const char STAMP_KEY[12];
+
+	static bool MakeStamp(const string &imagePath, SourceStamp &stamp)
+	{
+		struct stat info;
+
+		if (0 != stat(imagePath.c_str(), &info))
+		{
+			return false;
+		}
+
+		memset(&stamp, 0, sizeof(stamp));
+		stamp.version = TEXTURE_CACHE_VERSION;
+		stamp.sourceSize = (uint64_t)info.st_size;
+		stamp.sourceTime = (int64_t)info.st_mtime;
+
+		return true;
+	}
+
+	static vector<unsigned char> CompressLevel(const ImageData &image)
+	{
+		int blocksX = (image.width + 3) / 4;
+		int blocksY = (image.height + 3) / 4;
+		vector<unsigned char> blocks(blocksX * blocksY * 8);
+		const unsigned char *pixels = image.pixels.get();
+
+		for (int by = 0; by < blocksY; by++)
+		{
+			for (int bx = 0; bx < blocksX; bx++)
+			{
+				// Gather the 4x4 block, repeating the last row/column where the image doesn't fill it
+				int block[16][3];
+
+				for (int i = 0; i < 16; i++)
+				{
+					int x = min(bx * 4 + i % 4, image.width - 1);
+					int y = min(by * 4 + i / 4, image.height - 1);
+
+					for (int c = 0; c < 3; c++)
+					{
+						block[i][c] = pixels[(y * image.width + x) * 3 + c];
+					}
+				}
+
+				CompressBlock(block, &blocks[(by * blocksX + bx) * 8]);
+			}
+		}
+
+		return blocks;
+	}
+
+	// Encodes one block: the endpoints are the two pixels furthest apart along the block's main colour axis, every
+	// pixel then takes the closest of the four palette entries
+	static void CompressBlock(const int block[16][3], unsigned char *out)
+	{
+		int low[3] = { 255, 255, 255 };
+		int high[3] = { 0, 0, 0 };
+		int mean[3] = { 0, 0, 0 };
+
+		for (int i = 0; i < 16; i++)
+		{
+			for (int c = 0; c < 3; c++)
+			{
+				low[c] = min(low[c], block[i][c]);
+				high[c] = max(high[c], block[i][c]);
+				mean[c] += block[i][c];
+			}
+		}
+
+		// The axis is the bounding box diagonal, with each channel's direction taken from how it varies with the
+		// channel of widest range (a block going from red to green needs red falling while green rises)
+		int widest = 0;
+
+		for (int c = 1; c < 3; c++)
+		{
+			if (high[c] - low[c] > high[widest] - low[widest])
+			{
+				widest = c;
+			}
+		}
+
+		int axis[3];
+
+		for (int c = 0; c < 3; c++)
+		{
+			int covariance = 0;
+
+			for (int i = 0; i < 16; i++)
+			{
+				covariance += (block[i][c] * 16 - mean[c]) * (block[i][widest] * 16 - mean[widest]);
+			}
+
+			axis[c] = (covariance < 0) ? low[c] - high[c] : high[c] - low[c];
+		}
+
+		int lowest = 0, highest = 0;
+		int lowestProjection = INT32_MAX, highestProjection = INT32_MIN;
+
+		for (int i = 0; i < 16; i++)
+		{
+			int projection = block[i][0] * axis[0] + block[i][1] * axis[1] + block[i][2] * axis[2];
+
+			if (projection < lowestProjection)
+			{
+				lowestProjection = projection;
+				lowest = i;
+			}
+
+			if (projection > highestProjection)
+			{
+				highestProjection = projection;
+				highest = i;
+			}
+		}
+
+		uint16_t color0 = To565(block[highest]);
+		uint16_t color1 = To565(block[lowest]);
+		uint32_t indices = 0;
+
+		// color0 > color1 selects the four colour mode, equal endpoints mean a flat block where index 0 is exact
+		if (color0 < color1)
+		{
+			swap(color0, color1);
+		}
+
+		if (color0 != color1)
+		{
+			int palette[4][3];
+			From565(color0, palette[0]);
+			From565(color1, palette[1]);
+
+			for (int c = 0; c < 3; c++)
+			{
+				palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+				palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+			}
+
+			for (int i = 0; i < 16; i++)
+			{
+				uint32_t best = 0;
+				int bestDistance = INT32_MAX;
+
+				for (uint32_t j = 0; j < 4; j++)
+				{
+					int distance = 0;
+
+					for (int c = 0; c < 3; c++)
+					{
+						int delta = block[i][c] - palette[j][c];
+						distance += delta * delta;
+					}
+
+					if (distance < bestDistance)
+					{
+						bestDistance = distance;
+						best = j;
+					}
+				}
+
+				indices |= best << (i * 2);
+			}
+		}
+
+		memcpy(out, &color0, 2);
+		memcpy(out + 2, &color1, 2);
+		memcpy(out + 4, &indices, 4);
+	}
+
+	// Rounds to 5:6:5
+	static uint16_t To565(const int color[3])
+	{
+		return (uint16_t)(((color[0] * 31 + 127) / 255) << 11 | ((color[1] * 63 + 127) / 255) << 5 | ((color[2] * 31 + 127) / 255));
+	}
+
+	// Expands 5:6:5 back to 8 bits per channel the way the hardware does
+	static void From565(uint16_t color, int out[3])
+	{
+		int r = (color >> 11) & 31;
+		int g = (color >> 5) & 63;
+		int b = color & 31;
+
+		out[0] = (r << 3) | (r >> 2);
+		out[1] = (g << 2) | (g >> 4);
+		out[2] = (b << 3) | (b >> 2);
+	}
+};
+
+const unsigned char TextureCache::IDENTIFIER[12] = { 0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n' };
+const char TextureCache::STAMP_KEY[12] = "SourceStamp";
@@ -0,0 +1,180 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <cctype>
+
+#include <GL/glew.h>
+
+using namespace std;
+
+// Process-wide table of the 2D textures loaded from files, keyed by canonical path and reference counted. Models
+// sharing an image (the same cloud or specular map) get the same texture, so each file is decoded and uploaded once
+// however many models use it, and it is deleted when the last of them lets go.
+// Acquire/Release must be called on the GL thread. IsLoaded may be called from any thread (e.g. Model::Import, to
+// skip decoding images that are already resident).
+class TextureRegistry
+{
+public:
+	static TextureRegistry &Instance()
+	{
+		static TextureRegistry registry;
+		return registry;
+	}
+
+	// Returns the texture for the file at path, calling load() to create it only if it isn't loaded yet.
+	// Every Acquire has to be matched by a Release.
+	template <class Loader>
+	GLuint Acquire(const string &path, Loader load)
+	{
+		string key = Canonicalize(path);
+
+		{
+			lock_guard<mutex> lock(this->entriesMutex);
+			unordered_map<string, Entry>::iterator entry = this->entries.find(key);
+
+			this->requests++;
+
+			if (entry != this->entries.end())
+			{
+				entry->second.references++;
+				return entry->second.id;
+			}
+		}
+
+		// Not under the lock, loading can take a while and only happens on the GL thread anyway
+		GLuint id = load();
+
+		lock_guard<mutex> lock(this->entriesMutex);
+		Entry entry;
+		entry.id = id;
+		entry.references = 1;
+		this->entries[key] = entry;
+		this->paths[id] = key;
+		this->loads++;
+
+		return id;
+	}
+
+	// Drops one reference, the texture is deleted with the last one
+	void Release(GLuint id)
+	{
+		lock_guard<mutex> lock(this->entriesMutex);
+		unordered_map<GLuint, string>::iterator path = this->paths.find(id);
+
+		if (path == this->paths.end())
+		{
+			return;
+		}
+
+		unordered_map<string, Entry>::iterator entry = this->entries.find(path->second);
+
+		if (0 == --entry->second.references)
+		{
+			glDeleteTextures(1, &id);
+			this->entries.erase(entry);
+			this->paths.erase(path);
+		}
+	}
+
+	bool IsLoaded(const string &path)
+	{
+		string key = Canonicalize(path);
+
+		lock_guard<mutex> lock(this->entriesMutex);
+
+		return this->entries.count(key) > 0;
+	}
+
+	// Textures currently alive
+	size_t GetCount()
+	{
+		lock_guard<mutex> lock(this->entriesMutex);
+
+		return this->entries.size();
+	}
+
+	// Acquire calls so far, and how many of them had to load the file
+	GLuint GetRequests() const
+	{
+		return this->requests;
+	}
+
+	GLuint GetLoads() const
+	{
+		return this->loads;
+	}
+
+	// One spelling per file: forward slashes, no "." or empty components, ".." folded into its parent, and on
+	// Windows (case insensitive file names) lower case. "models/./Earth.jpg", "models\\Earth.jpg" and
+	// "textures/../models/Earth.jpg" all become "models/Earth.jpg".
+	static string Canonicalize(const string &path)
+	{
+		vector<string> parts;
+		bool absolute = !path.empty() && ('/' == path[0] || '\\' == path[0]);
+		size_t start = 0;
+
+		while (start <= path.size())
+		{
+			size_t end = path.find_first_of("/\\", start);
+
+			if (string::npos == end)
+			{
+				end = path.size();
+			}
+
+			string part = path.substr(start, end - start);
+
+			if (".." == part && !parts.empty() && ".." != parts.back())
+			{
+				parts.pop_back();
+			}
+			else if (".." == part && absolute && parts.empty())
+			{
+				// Nothing above the root
+			}
+			else if (!part.empty() && "." != part)
+			{
+				parts.push_back(part);
+			}
+
+			start = end + 1;
+		}
+
+		string canonical = absolute ? "/" : "";
+
+		for (size_t i = 0; i < parts.size(); i++)
+		{
+			canonical += (i ? "/" : "") + parts[i];
+		}
+
+#ifdef _WIN32
+		for (size_t i = 0; i < canonical.size(); i++)
+		{
+			canonical[i] = (char)tolower((unsigned char)canonical[i]);
+		}
+#endif
+
+		return canonical;
+	}
+
+private:
+	struct Entry
+	{
+		GLuint id;
+		GLuint references;
+	};
+
+	mutex entriesMutex;
+	unordered_map<string, Entry> entries;
+	// Reverse lookup for Release
+	unordered_map<GLuint, string> paths;
+	GLuint requests = 0;
+	GLuint loads = 0;
+
+	TextureRegistry() {}
+	TextureRegistry(const TextureRegistry &);
+	TextureRegistry &operator=(const TextureRegistry &);
+};
@@ -0,0 +1,401 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <list>
+#include <future>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <algorithm>
+
+#include <GL/glew.h>
+
+#include "ImageData.h"
+#include "TextureCache.h"
+#include "MipChain.h"
+#include "ThreadPool.h"
+
+using namespace std;
+
+// Largest side of the low resolution preview shown while the full texture is still streaming in
+const int STREAM_PREVIEW_SIZE = 64;
+
+// Streams 2D textures in without stalling the render loop:
+//  1. Request() hands out a texture id straight away, holding a 1x1 grey placeholder.
+//  2. The image is decoded on the thread pool, and its mip chain built there too (see MipChain). The first level
+//     that fits STREAM_PREVIEW_SIZE is the preview.
+//  3. Update(), called once per frame, uploads the preview and shows it by clamping the texture's base/max level
+//     to it, then streams the full resolution rows through a ring of pixel buffer objects, a few MB per frame.
+//  4. Once level 0 is complete the rest of the chain is uploaded and the texture switches over to it.
+// Decode and upload times are printed for every texture when it becomes resident.
+// Where S3TC is supported, files requested by path go through the TextureCache instead: the worker reads (or on the
+// first run transcodes) a BC1 mip chain, which is a sixth of the size and is uploaded whole in step 3.
+class TextureStreamer
+{
+public:
+	TextureStreamer(ThreadPool &pool, GLuint pboCount = 3, GLsizeiptr pboSize = 4 << 20, GLsizeiptr frameBudget = 8 << 20)
+		: pool(pool), pboSize(pboSize), frameBudget(frameBudget), nextPbo(0), compress(TextureCache::IsSupported()), residentBytes(0), uncompressedBytes(0),
+		  pboFailed(false)
+	{
+		this->pbos.resize(pboCount);
+		this->pboSizes.assign(pboCount, pboSize);
+		glGenBuffers(pboCount, &this->pbos[0]);
+
+		for (GLuint i = 0; i < pboCount; i++)
+		{
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, this->pbos[i]);
+			glBufferData(GL_PIXEL_UNPACK_BUFFER, pboSize, NULL, GL_STREAM_DRAW);
+		}
+
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	}
+
+	~TextureStreamer()
+	{
+		glDeleteBuffers((GLsizei)this->pbos.size(), &this->pbos[0]);
+	}
+
+	// Starts decoding the file on the thread pool, the returned texture is usable immediately
+	GLuint Request(const string &path, const string &directory)
+	{
+		Stream stream(path);
+		stream.id = createPlaceholder();
+		bool compress = this->compress;
+		stream.pending = this->pool.Enqueue([path, directory, compress]()
+		{
+			chrono::steady_clock::time_point start = chrono::steady_clock::now();
+			DecodedTexture result;
+
+			if (compress && TextureCache::Get(directory + '/' + path, result.compressed, result.transcoded))
+			{
+				result.decodeMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+				return result;
+			}
+
+			return decode(LoadImageData(path.c_str(), directory), start);
+		});
+		this->streams.push_back(move(stream));
+
+		return this->streams.back().id;
+	}
+
+	// Same as above for an image that is already decoded (e.g. by Model::Import), only the preview is built in the background
+	GLuint Request(const string &name, const ImageData &image)
+	{
+		Stream stream(name);
+		stream.id = createPlaceholder();
+		stream.pending = this->pool.Enqueue([image]() { return decode(image, chrono::steady_clock::now()); });
+		this->streams.push_back(move(stream));
+
+		return this->streams.back().id;
+	}
+
+	// Call once per frame on the GL thread
+	void Update()
+	{
+		GLsizeiptr budget = this->frameBudget;
+
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+		for (list<Stream>::iterator stream = this->streams.begin(); stream != this->streams.end();)
+		{
+			if (DECODING == stream->state)
+			{
+				if (future_status::ready != stream->pending.wait_for(chrono::seconds(0)))
+				{
+					++stream;
+					continue;
+				}
+
+				stream->decoded = stream->pending.get();
+
+				if (!stream->decoded.compressed.levels.empty())
+				{
+					budget -= this->uploadCompressed(*stream);
+					stream = this->streams.erase(stream);
+					continue;
+				}
+
+				if (!stream->decoded.full.pixels)
+				{
+					cout << "ERROR::TEXTURE_STREAMER:: could not decode " << stream->name << endl;
+					stream = this->streams.erase(stream);
+					continue;
+				}
+
+				this->beginUpload(*stream);
+			}
+
+			if (budget > 0)
+			{
+				budget -= this->uploadRows(*stream, budget);
+			}
+
+			if (stream->nextRow < stream->decoded.full.height)
+			{
+				stream->frames++;
+				++stream;
+				continue;
+			}
+
+			this->finishUpload(*stream);
+			stream = this->streams.erase(stream);
+		}
+
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	}
+
+	// True once every requested texture is fully resident
+	bool IsIdle() const
+	{
+		return this->streams.empty();
+	}
+
+	// Video memory of the textures streamed in so far, and what they would take as uncompressed RGB8
+	size_t GetResidentBytes() const
+	{
+		return this->residentBytes;
+	}
+
+	size_t GetUncompressedBytes() const
+	{
+		return this->uncompressedBytes;
+	}
+
+private:
+	enum StreamState
+	{
+		DECODING,
+		UPLOADING
+	};
+
+	// Worker thread output, the full image, its mip chain (full again at level 0) and which level is the preview
+	struct DecodedTexture
+	{
+		ImageData full;
+		vector<ImageData> mips;
+		int previewLevel = 0;
+		// Filled in instead of full/preview when the texture came through the TextureCache
+		CompressedImage compressed;
+		bool transcoded = false;
+		double decodeMs = 0.0;
+	};
+
+	struct Stream
+	{
+		Stream(const string &name) : name(name), id(0), state(DECODING), nextRow(0), frames(0), requested(chrono::steady_clock::now()) {}
+
+		string name;
+		GLuint id;
+		StreamState state;
+		future<DecodedTexture> pending;
+		DecodedTexture decoded;
+		GLint nextRow;
+		int frames;
+		chrono::steady_clock::time_point requested;
+		chrono::steady_clock::time_point uploadStarted;
+	};
+
+	ThreadPool &pool;
+	vector<GLuint> pbos;
+	// Current size of each PBO, at least pboSize (one grows when a single row doesn't fit)
+	vector<GLsizeiptr> pboSizes;
+	GLsizeiptr pboSize;
+	GLsizeiptr frameBudget;
+	GLuint nextPbo;
+	bool compress;
+	list<Stream> streams;
+	size_t residentBytes;
+	size_t uncompressedBytes;
+	// Set by the first PBO that couldn't be mapped or lost its contents, so that is only reported once
+	bool pboFailed;
+
+	// Runs on the thread pool, start is when decoding began so the file read is included in the timing
+	static DecodedTexture decode(const ImageData &image, chrono::steady_clock::time_point start)
+	{
+		DecodedTexture result;
+		result.full = image;
+
+		if (image.pixels)
+		{
+			// Already on a worker, so the chain is built on this thread alone
+			result.mips = MipChain::Generate(image);
+
+			// Pick the first mip level that fits in the preview size
+			while (max(result.mips[result.previewLevel].width, result.mips[result.previewLevel].height) > STREAM_PREVIEW_SIZE)
+			{
+				result.previewLevel++;
+			}
+		}
+
+		result.decodeMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+		return result;
+	}
+
+	static GLuint createPlaceholder()
+	{
+		const unsigned char grey[3] = { 128, 128, 128 };
+		GLuint textureID;
+
+		glGenTextures(1, &textureID);
+		glBindTexture(GL_TEXTURE_2D, textureID);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 1, 1, 0, GL_RGB, GL_UNSIGNED_BYTE, grey);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+
+		// Parameters
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		return textureID;
+	}
+
+	// Allocates the whole mip chain, fills in the preview level and restricts sampling to it
+	void beginUpload(Stream &stream)
+	{
+		const DecodedTexture &decoded = stream.decoded;
+
+		glBindTexture(GL_TEXTURE_2D, stream.id);
+
+		for (int level = 0; level < (int)decoded.mips.size(); level++)
+		{
+			const ImageData &mip = decoded.mips[level];
+			const unsigned char *pixels = (level == decoded.previewLevel) ? mip.pixels.get() : NULL;
+			glTexImage2D(GL_TEXTURE_2D, level, GL_RGB, mip.width, mip.height, 0, GL_RGB, GL_UNSIGNED_BYTE, pixels);
+		}
+
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, decoded.previewLevel);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, decoded.previewLevel);
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		stream.state = UPLOADING;
+		stream.uploadStarted = chrono::steady_clock::now();
+	}
+
+	// Copies as many full resolution rows as the budget allows into the next PBOs and from there into level 0. Rows a
+	// PBO fails for go up straight from the image instead. Returns the number of bytes uploaded.
+	GLsizeiptr uploadRows(Stream &stream, GLsizeiptr budget)
+	{
+		const ImageData &image = stream.decoded.full;
+		GLsizeiptr rowSize = (GLsizeiptr)image.width * 3;
+		GLsizeiptr uploaded = 0;
+
+		glBindTexture(GL_TEXTURE_2D, stream.id);
+
+		while (stream.nextRow < image.height && uploaded < budget)
+		{
+			GLint rows = (GLint)min<GLsizeiptr>(max<GLsizeiptr>(1, this->pboSize / rowSize), image.height - stream.nextRow);
+			GLsizeiptr size = rows * rowSize;
+			const unsigned char *src = image.pixels.get() + stream.nextRow * rowSize;
+			GLuint index = this->nextPbo;
+			this->nextPbo = (this->nextPbo + 1) % this->pbos.size();
+
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, this->pbos[index]);
+
+			if (size > this->pboSizes[index])
+			{
+				// A single row bigger than a PBO, grow this one
+				glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+				this->pboSizes[index] = size;
+			}
+
+			// Invalidating lets the driver hand us fresh memory instead of waiting on the previous upload from this PBO
+			void *dst = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+			bool copied = false;
+
+			if (dst)
+			{
+				memcpy(dst, src, size);
+				// GL_FALSE means the store was corrupted while mapped (e.g. a mode switch), so its contents can't be trusted
+				copied = GL_FALSE != glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+			}
+
+			if (copied)
+			{
+				glTexSubImage2D(GL_TEXTURE_2D, 0, 0, stream.nextRow, image.width, rows, GL_RGB, GL_UNSIGNED_BYTE, (GLvoid *)0);
+			}
+			else
+			{
+				if (!this->pboFailed)
+				{
+					cout << "WARNING::TEXTURE_STREAMER:: PBO upload failed for " << stream.name << ", uploading those rows directly" << endl;
+					this->pboFailed = true;
+				}
+
+				// Same rows straight from the image, which blocks until GL has copied them
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+				glTexSubImage2D(GL_TEXTURE_2D, 0, 0, stream.nextRow, image.width, rows, GL_RGB, GL_UNSIGNED_BYTE, src);
+			}
+
+			stream.nextRow += rows;
+			uploaded += size;
+		}
+
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		return uploaded;
+	}
+
+	// A compressed chain is small enough to go up in one go, straight from the decoded data. Returns the bytes uploaded.
+	GLsizeiptr uploadCompressed(Stream &stream)
+	{
+		const CompressedImage &image = stream.decoded.compressed;
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+		glBindTexture(GL_TEXTURE_2D, stream.id);
+		TextureCache::Upload(GL_TEXTURE_2D, image);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)image.levels.size() - 1);
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		this->residentBytes += image.GetBytes();
+		this->uncompressedBytes += image.GetUncompressedBytes();
+
+		chrono::steady_clock::time_point now = chrono::steady_clock::now();
+		cout << "Streamed " << stream.name << " (" << image.width << "x" << image.height << ", BC1 " << (stream.decoded.transcoded ? "transcoded" : "from cache")
+			<< "): " << image.GetBytes() / 1024 << " KB instead of " << image.GetUncompressedBytes() / 1024 << " KB, decode " << stream.decoded.decodeMs
+			<< " ms, upload " << chrono::duration<double, milli>(now - start).count() << " ms, " << chrono::duration<double, milli>(now - stream.requested).count()
+			<< " ms after request" << endl;
+
+		return (GLsizeiptr)image.GetBytes();
+	}
+
+	// Level 0 is in, fill in the rest of the precomputed chain (a third of level 0's size) and open up the full range
+	// of levels
+	void finishUpload(Stream &stream)
+	{
+		const vector<ImageData> &mips = stream.decoded.mips;
+
+		glBindTexture(GL_TEXTURE_2D, stream.id);
+
+		for (int level = 1; level < (int)mips.size(); level++)
+		{
+			if (level != stream.decoded.previewLevel)
+			{
+				glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, mips[level].width, mips[level].height, GL_RGB, GL_UNSIGNED_BYTE, mips[level].pixels.get());
+			}
+		}
+
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)mips.size() - 1);
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		// Level 0 plus about a third for the rest of the chain
+		size_t bytes = (size_t)stream.decoded.full.width * stream.decoded.full.height * 3 * 4 / 3;
+		this->residentBytes += bytes;
+		this->uncompressedBytes += bytes;
+
+		chrono::steady_clock::time_point now = chrono::steady_clock::now();
+		cout << "Streamed " << stream.name << " (" << stream.decoded.full.width << "x" << stream.decoded.full.height << "): decode "
+			<< stream.decoded.decodeMs << " ms, upload " << chrono::duration<double, milli>(now - stream.uploadStarted).count() << " ms over "
+			<< stream.frames + 1 << " frame(s), " << chrono::duration<double, milli>(now - stream.requested).count() << " ms after request" << endl;
+	}
+};
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <utility>
+
+using namespace std;
+
+// A fixed set of worker threads pulling jobs off a shared queue. Used for the CPU side of asset loading
+// (file parsing, image decoding) and per-frame CPU work, never for anything that touches the GL context.
+class ThreadPool
+{
+public:
+	// Constructor, defaults to one worker per hardware thread
+	ThreadPool(unsigned int threadCount = thread::hardware_concurrency()) : nextJob(0), stopping(false)
+	{
+		if (0 == threadCount)
+		{
+			threadCount = 1;
+		}
+
+		// Room for a few jobs per worker up front, so per-frame jobs (e.g. one per worker) never grow the queue
+		this->jobs.reserve(threadCount * 4);
+
+		for (unsigned int i = 0; i < threadCount; i++)
+		{
+			this->workers.push_back(thread(&ThreadPool::workerLoop, this));
+		}
+	}
+
+	// Finishes the queued jobs, then joins the workers
+	~ThreadPool()
+	{
+		{
+			unique_lock<mutex> lock(this->queueMutex);
+			this->stopping = true;
+		}
+
+		this->queueCondition.notify_all();
+
+		for (size_t i = 0; i < this->workers.size(); i++)
+		{
+			this->workers[i].join();
+		}
+	}
+
+	// Queues a job and returns a future for its result
+	template <class F>
+	future<decltype(declval<F>()())> Enqueue(F job)
+	{
+		typedef decltype(declval<F>()()) Result;
+
+		shared_ptr<packaged_task<Result()>> task = make_shared<packaged_task<Result()>>(job);
+		future<Result> result = task->get_future();
+
+		this->Post([task]() { (*task)(); });
+
+		return result;
+	}
+
+	// Queues a job without a future, for callers that track completion themselves. Doesn't allocate once the queue
+	// has been this long before, provided the job fits std::function's small buffer (e.g. a lambda capturing two
+	// pointers), so it can be used every frame.
+	void Post(function<void()> job)
+	{
+		{
+			unique_lock<mutex> lock(this->queueMutex);
+			this->jobs.push_back(move(job));
+		}
+
+		this->queueCondition.notify_one();
+	}
+
+	size_t GetThreadCount() const
+	{
+		return this->workers.size();
+	}
+
+private:
+	vector<thread> workers;
+	// Jobs from nextJob on are waiting. Emptied (keeping its capacity) whenever the last one is taken.
+	vector<function<void()>> jobs;
+	size_t nextJob;
+	mutex queueMutex;
+	condition_variable queueCondition;
+	bool stopping;
+
+	void workerLoop()
+	{
+		for (;;)
+		{
+			function<void()> job;
+
+			{
+				unique_lock<mutex> lock(this->queueMutex);
+				this->queueCondition.wait(lock, [this]() { return this->stopping || this->nextJob < this->jobs.size(); });
+
+				if (this->stopping && this->nextJob == this->jobs.size())
+				{
+					return;
+				}
+
+				job = move(this->jobs[this->nextJob++]);
+
+				if (this->nextJob == this->jobs.size())
+				{
+					this->jobs.clear();
+					this->nextJob = 0;
+				}
+			}
+
+			job();
+		}
+	}
+
+	ThreadPool(const ThreadPool &);
+	ThreadPool &operator=(const ThreadPool &);
+};
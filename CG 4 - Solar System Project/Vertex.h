@@ -0,0 +1,13 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+struct Vertex
+{
+	// Position
+	glm::vec3 Position;
+	// Normal
+	glm::vec3 Normal;
+	// TexCoords
+	glm::vec2 TexCoords;
+};
@@ -0,0 +1,180 @@
+// Load-time benchmark: writes a large OBJ (several UV spheres, one object each), then loads it the way main.cpp loads
+// the planets and reports time and heap allocations for Model::Import and for the GL upload into a GeometryArena.
+// Runs twice, first through Assimp (the model cache is deleted beforehand) and then from the cache the first run wrote.
+// Not part of the scene, build it on its own next to main.cpp, e.g.
+//   g++ -O2 -std=c++14 -DCOUNT_ALLOCATIONS bench_load.cpp -o bench_load -lglfw -lGLEW -lGL -lassimp -lsoil2 -lpthread
+// Without COUNT_ALLOCATIONS only the times are reported.
+// Usage: bench_load [--meshes M] [--segments N], each sphere has (N + 1) * (N / 2 + 1) vertices and N * N
+// triangles, the default is 8 spheres of 1024 segments (~4.2M vertices, ~8.4M triangles).
+
+#include <string>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+#include <iostream>
+#include <fstream>
+#include <chrono>
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+
+#include "Shader.h"
+#include "Model.h"
+#include "GeometryArena.h"
+#include "AllocationCounter.h"
+
+const char *BENCH_MODEL_PATH = "bench_load.obj";
+
+// Writes meshCount UV spheres, each its own object so Assimp gives it its own mesh
+void WriteSpheres(const char *path, GLuint meshCount, GLuint segments)
+{
+	const GLuint rings = segments / 2;
+	const double pi = 3.14159265358979323846;
+	ofstream file(path);
+	GLuint firstVertex = 1;
+
+	for (GLuint mesh = 0; mesh < meshCount; mesh++)
+	{
+		file << "o sphere" << mesh << "\n";
+
+		for (GLuint ring = 0; ring <= rings; ring++)
+		{
+			double theta = pi * ring / rings;
+
+			for (GLuint segment = 0; segment <= segments; segment++)
+			{
+				double phi = 2.0 * pi * segment / segments;
+				double x = sin(theta) * cos(phi), y = cos(theta), z = sin(theta) * sin(phi);
+
+				file << "v " << x + 3.0 * mesh << ' ' << y << ' ' << z << "\n";
+				file << "vn " << x << ' ' << y << ' ' << z << "\n";
+				file << "vt " << (double)segment / segments << ' ' << (double)ring / rings << "\n";
+			}
+		}
+
+		for (GLuint ring = 0; ring < rings; ring++)
+		{
+			for (GLuint segment = 0; segment < segments; segment++)
+			{
+				GLuint a = firstVertex + ring * (segments + 1) + segment, b = a + segments + 1;
+
+				file << "f " << a << '/' << a << '/' << a << ' ' << b << '/' << b << '/' << b << ' ' << a + 1 << '/' << a + 1 << '/' << a + 1 << "\n";
+				file << "f " << a + 1 << '/' << a + 1 << '/' << a + 1 << ' ' << b << '/' << b << '/' << b << ' ' << b + 1 << '/' << b + 1 << '/' << b + 1 << "\n";
+			}
+		}
+
+		firstVertex += (rings + 1) * (segments + 1);
+	}
+}
+
+void PrintAllocations(size_t allocations)
+{
+	if (AllocationCounter::IsEnabled())
+	{
+		cout << allocations << " allocations";
+	}
+	else
+	{
+		cout << "allocations not counted";
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	GLuint meshCount = 8;
+	GLuint segments = 1024;
+
+	for (int i = 1; i + 1 < argc; i++)
+	{
+		if (0 == strcmp(argv[i], "--meshes"))
+		{
+			meshCount = (GLuint)strtoul(argv[++i], nullptr, 10);
+		}
+		else if (0 == strcmp(argv[i], "--segments"))
+		{
+			segments = (GLuint)strtoul(argv[++i], nullptr, 10);
+		}
+	}
+
+	if (0 == meshCount || segments < 4)
+	{
+		cout << "ERROR::BENCH_LOAD:: need at least one mesh of at least 4 segments" << endl;
+		return EXIT_FAILURE;
+	}
+
+	WriteSpheres(BENCH_MODEL_PATH, meshCount, segments);
+	remove(ModelCache::GetCachePath(BENCH_MODEL_PATH).c_str());
+
+	// The upload needs a context, a hidden window is enough
+	glfwInit();
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+	glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
+	GLFWwindow *window = glfwCreateWindow(64, 64, "bench_load", nullptr, nullptr);
+
+	if (nullptr == window)
+	{
+		cout << "ERROR::BENCH_LOAD:: could not create a GL context" << endl;
+		glfwTerminate();
+		return EXIT_FAILURE;
+	}
+
+	glfwMakeContextCurrent(window);
+	glewExperimental = GL_TRUE;
+
+	if (GLEW_OK != glewInit())
+	{
+		cout << "ERROR::BENCH_LOAD:: could not initialise GLEW" << endl;
+		glfwTerminate();
+		return EXIT_FAILURE;
+	}
+
+	const char *passes[2] = { "Assimp", "cache" };
+
+	for (GLuint pass = 0; pass < 2; pass++)
+	{
+		size_t allocationsBefore = AllocationCounter::Get();
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		// No textures in the file, but main.cpp leaves them to the streamer anyway
+		ModelData data = Model::Import(BENCH_MODEL_PATH, false);
+		double importMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+		size_t importAllocations = AllocationCounter::Get() - allocationsBefore;
+
+		size_t vertexCount = 0, indexCount = 0;
+
+		for (GLuint i = 0; i < data.meshes.size(); i++)
+		{
+			vertexCount += data.meshes[i].vertices.size();
+			indexCount += data.meshes[i].indices.size();
+		}
+
+		{
+			// Sized up front like a scene that knows its models, so the arena's growth copies aren't part of the figure
+			GeometryArena arena((GLsizei)vertexCount, (GLsizei)indexCount);
+
+			allocationsBefore = AllocationCounter::Get();
+			start = chrono::steady_clock::now();
+			Model model(std::move(data), nullptr, &arena, RESIDENCY_DISCARD);
+			glFinish();
+			double uploadMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+			size_t uploadAllocations = AllocationCounter::Get() - allocationsBefore;
+
+			cout << "From " << passes[pass] << ": " << model.GetMeshes().size() << " meshes, " << vertexCount << " vertices, " << indexCount / 3
+				<< " triangles" << endl;
+			cout << "  Model::Import  " << importMs << " ms, ";
+			PrintAllocations(importAllocations);
+			cout << endl << "  upload         " << uploadMs << " ms, ";
+			PrintAllocations(uploadAllocations);
+			cout << endl;
+		}
+	}
+
+	remove(ModelCache::GetCachePath(BENCH_MODEL_PATH).c_str());
+	remove(BENCH_MODEL_PATH);
+	glfwTerminate();
+
+	return EXIT_SUCCESS;
+}
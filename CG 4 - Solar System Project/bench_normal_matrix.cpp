@@ -0,0 +1,208 @@
+// Vertex-stage benchmark for the per-object normal matrix: draws a planet model many times per frame with
+// modelLoadingVertex.txt as shipped (normalMatrix uniform, computed once per draw on the CPU) and with the same shader
+// evaluating mat3(transpose(inverse(model))) per vertex, as it did before. The viewport is 1x1 so the fragment stage
+// costs next to nothing and the frame time is the vertex stage.
+// Not part of the scene, build it on its own next to main.cpp and run it from this directory (it reads models/ and
+// the shader files), e.g.
+//   g++ -O2 -std=c++14 bench_normal_matrix.cpp -o bench_normal_matrix -lglfw -lGLEW -lGL -lassimp -lsoil2 -lpthread
+//   LIBGL_ALWAYS_SOFTWARE=1 GALLIUM_DRIVER=llvmpipe ./bench_normal_matrix
+// Usage: bench_normal_matrix [--model path] [--draws N] [--frames F], defaults "models/Jupiter 2K.obj", 200 draws
+// per frame, 50 timed frames.
+
+#include <string>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/matrix_inverse.hpp>
+
+#include "Shader.h"
+#include "Model.h"
+
+const char *BENCH_SHADER_PATH = "modelLoadingVertex.txt";
+// The pre-normalMatrix variant of it, written next to it for the run and removed afterwards
+const char *BENCH_PER_VERTEX_SHADER_PATH = "bench_normal_matrix_vertex.txt";
+const GLuint WARMUP_FRAMES = 5;
+
+// Rewrites the shipped vertex shader to invert the model matrix per vertex again. False if it no longer looks like
+// the shader this was written against.
+bool WritePerVertexShader()
+{
+	ifstream file(BENCH_SHADER_PATH);
+	stringstream stream;
+	stream << file.rdbuf();
+	string source = stream.str();
+
+	const string declaration = "uniform mat3 normalMatrix;";
+	const string use = "normalMatrix * normal";
+	size_t declarationAt = source.find(declaration);
+
+	if (string::npos == declarationAt)
+	{
+		return false;
+	}
+
+	source.erase(declarationAt, declaration.size());
+	size_t useAt = source.find(use);
+
+	if (string::npos == useAt)
+	{
+		return false;
+	}
+
+	source.replace(useAt, use.size(), "mat3(transpose(inverse(model))) * normal");
+
+	ofstream out(BENCH_PER_VERTEX_SHADER_PATH);
+	out << source;
+
+	return out.good();
+}
+
+// Average milliseconds per frame of drawCount draws of the model, each with its own model matrix
+double TimeFrames(Model &model, Shader &shader, bool normalMatrixUniform, GLuint drawCount, GLuint frameCount)
+{
+	glm::mat4 viewProjection = glm::perspective(glm::radians(45.0f), 1.0f, 0.1f, 100.0f)
+		* glm::lookAt(glm::vec3(0.0f, 0.0f, 5.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+
+	shader.Use();
+	shader.setMat4("viewProjection", viewProjection);
+	shader.setVec3("lightPos", 0.0f, 0.0f, 10.0f);
+	shader.setVec3("viewPos", 0.0f, 0.0f, 5.0f);
+	shader.setVec3("lightColor", 1.0f, 1.0f, 1.0f);
+	shader.setVec3("objectColor", 1.0f, 1.0f, 1.0f);
+
+	chrono::steady_clock::time_point start;
+
+	for (GLuint frame = 0; frame < WARMUP_FRAMES + frameCount; frame++)
+	{
+		if (WARMUP_FRAMES == frame)
+		{
+			glFinish();
+			start = chrono::steady_clock::now();
+		}
+
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+		for (GLuint i = 0; i < drawCount; i++)
+		{
+			glm::mat4 transform = glm::rotate(glm::mat4(1.0f), 0.01f * i, glm::vec3(0.3f, 1.0f, 0.0f));
+			transform = glm::scale(transform, glm::vec3(0.01f));
+			shader.setMat4("model", transform);
+
+			if (normalMatrixUniform)
+			{
+				shader.setMat3("normalMatrix", glm::inverseTranspose(glm::mat3(transform)));
+			}
+
+			model.Draw(shader);
+		}
+	}
+
+	glFinish();
+
+	return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() / frameCount;
+}
+
+int main(int argc, char *argv[])
+{
+	string modelPath = "models/Jupiter 2K.obj";
+	GLuint drawCount = 200;
+	GLuint frameCount = 50;
+
+	for (int i = 1; i + 1 < argc; i++)
+	{
+		if (0 == strcmp(argv[i], "--model"))
+		{
+			modelPath = argv[++i];
+		}
+		else if (0 == strcmp(argv[i], "--draws"))
+		{
+			drawCount = (GLuint)strtoul(argv[++i], nullptr, 10);
+		}
+		else if (0 == strcmp(argv[i], "--frames"))
+		{
+			frameCount = (GLuint)strtoul(argv[++i], nullptr, 10);
+		}
+	}
+
+	if (0 == drawCount || 0 == frameCount)
+	{
+		cout << "ERROR::BENCH_NORMAL_MATRIX:: need at least one draw and one frame" << endl;
+		return EXIT_FAILURE;
+	}
+
+	if (!WritePerVertexShader())
+	{
+		cout << "ERROR::BENCH_NORMAL_MATRIX:: " << BENCH_SHADER_PATH << " doesn't read a normalMatrix uniform any more" << endl;
+		return EXIT_FAILURE;
+	}
+
+	// A hidden window is enough, nothing is presented
+	glfwInit();
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+	glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
+	GLFWwindow *window = glfwCreateWindow(64, 64, "bench_normal_matrix", nullptr, nullptr);
+
+	if (nullptr == window)
+	{
+		cout << "ERROR::BENCH_NORMAL_MATRIX:: could not create a GL context" << endl;
+		glfwTerminate();
+		remove(BENCH_PER_VERTEX_SHADER_PATH);
+		return EXIT_FAILURE;
+	}
+
+	glfwMakeContextCurrent(window);
+	glewExperimental = GL_TRUE;
+
+	if (GLEW_OK != glewInit())
+	{
+		cout << "ERROR::BENCH_NORMAL_MATRIX:: could not initialise GLEW" << endl;
+		glfwTerminate();
+		remove(BENCH_PER_VERTEX_SHADER_PATH);
+		return EXIT_FAILURE;
+	}
+
+	cout << "Renderer: " << glGetString(GL_RENDERER) << endl;
+
+	glViewport(0, 0, 1, 1);
+	glEnable(GL_DEPTH_TEST);
+
+	{
+		ModelData data = Model::Import(modelPath);
+		size_t vertexCount = 0;
+
+		for (GLuint i = 0; i < data.meshes.size(); i++)
+		{
+			vertexCount += data.meshes[i].indices.size();
+		}
+
+		Model model(std::move(data));
+		Shader uniformShader(BENCH_SHADER_PATH, "modelLoadingFrag.txt");
+		Shader perVertexShader(BENCH_PER_VERTEX_SHADER_PATH, "modelLoadingFrag.txt");
+
+		double perVertexMs = TimeFrames(model, perVertexShader, false, drawCount, frameCount);
+		double uniformMs = TimeFrames(model, uniformShader, true, drawCount, frameCount);
+		// Vertices the vertex stage runs per frame, counting every index since that is an upper bound without a post-transform cache
+		double verticesPerFrame = (double)vertexCount * drawCount;
+
+		cout << modelPath << ": " << vertexCount << " indexed vertices, " << drawCount << " draws per frame, " << frameCount << " frames" << endl;
+		cout << "  inverse per vertex     " << perVertexMs << " ms/frame, " << verticesPerFrame / (perVertexMs * 1000.0) << " M vertices/s" << endl;
+		cout << "  normalMatrix uniform   " << uniformMs << " ms/frame, " << verticesPerFrame / (uniformMs * 1000.0) << " M vertices/s" << endl;
+	}
+
+	remove(BENCH_PER_VERTEX_SHADER_PATH);
+	glfwTerminate();
+
+	return EXIT_SUCCESS;
+}
@@ -14,6 +14,7 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <glm/gtc/matrix_inverse.hpp>
 
 // Assimp includes
 #include <assimp/cimport.h> // scene importer
@@ -22,49 +23,111 @@
 
 
 #include <iostream>
+#include <memory>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
 
 // Other includes
 #include "Shader.h"
 #include "Camera.h"
 #include "Model.h"
 #include "Texture.h"
+#include "ThreadPool.h"
+#include "InstanceBuffer.h"
+#include "GeometryArena.h"
+#include "MaterialPacker.h"
+#include "SceneRenderer.h"
+#include "SceneFramebuffer.h"
+#include "RenderQueue.h"
+#include "StateTracker.h"
+#include "AllocationCounter.h"
+#include "AsteroidBelt.h"
 
 
 // Properties
 const GLuint WIDTH = 1600, HEIGHT = 900;
+// Full screen windows can't be resized, so the default is a resizable window of WIDTH x HEIGHT
+const bool FULL_SCREEN = false;
 int SCREEN_WIDTH, SCREEN_HEIGHT;
+// Set by FramebufferSizeCallback, handled at the start of the next frame
+bool framebufferResized = false;
+// Rocks in the belt between Mars and Jupiter unless "--asteroids N" says otherwise (e.g. 1000000 for the update
+// benchmark), and the frame time the benchmark on exit is measured against
+const GLuint DEFAULT_ASTEROID_COUNT = 20000;
+const double TARGET_FRAME_MS = 1000.0 / 60.0;
+// Frames each submission path gets to grow its queues before it must stop allocating
+const GLuint ALLOCATION_WARMUP_FRAMES = 3;
+// With COUNT_ALLOCATIONS defined (see README.md), the number of steady state frames after which the render thread must
+// not have allocated at all. Steady state starts once the textures have streamed in and the materials are packed, and
+// skips each submission path's warm-up frames. If anything allocated, the program stops there with an error and a
+// non-zero exit status.
+const GLuint ALLOCATION_CHECK_FRAMES = 300;
+// Nothing reads the model geometry back on the CPU, so it only needs to live on the GPU
+const MeshResidency MODEL_RESIDENCY = RESIDENCY_DISCARD;
 using namespace irrklang;
 
 ISoundEngine *SoundEngine = createIrrKlangDevice();
 // Function prototypes
 void KeyCallback(GLFWwindow *window, int key, int scancode, int action, int mode);
 void MouseCallback(GLFWwindow *window, double xPos, double yPos);
+void ScrollCallback(GLFWwindow *window, double xOffset, double yOffset);
+void FramebufferSizeCallback(GLFWwindow *window, int width, int height);
 void DoMovement();
 
+// Submit the planets through the SceneRenderer (multi-draw indirect on GL 4.3) rather than the sorted RenderQueue,
+// toggled with M to compare the CPU time of both
+bool sceneSubmission = true;
+
 // Camera
-Camera camera(glm::vec3(0.0f, 100.0f, 100.0f));
+Camera camera(glm::dvec3(0.0, 100.0, 100.0));
 bool keys[1024];
 GLfloat lastX = 400, lastY = 300;
 bool firstMouse = true;
 
-glm::vec3 lightPos(0.0f, 0.0f, 0.0f);
+// World position of the sun's light. Shaders get positions relative to the camera (see Camera.h), so this is converted
+// every frame, and their viewPos is always the origin.
+glm::dvec3 lightPos(0.0, 0.0, 0.0);
 
 GLfloat deltaTime = 0.0f;
 GLfloat lastFrame = 0.0f;
 
-int main()
+int main(int argc, char *argv[])
 {
+	GLuint asteroidCount = DEFAULT_ASTEROID_COUNT;
+	// Jupiter's four largest moons are extra instances of the moon model, only drawn with "--galilean-moons"
+	bool galileanMoons = false;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (0 == strcmp(argv[i], "--asteroids") && i + 1 < argc)
+		{
+			asteroidCount = (GLuint)strtoul(argv[++i], nullptr, 10);
+		}
+		else if (0 == strcmp(argv[i], "--galilean-moons"))
+		{
+			galileanMoons = true;
+		}
+	}
+
 	// Init GLFW
 	glfwInit();
 	// Set all the required options for GLFW
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
 	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
-	glfwWindowHint(GLFW_RESIZABLE, GL_FALSE);
+	glfwWindowHint(GLFW_RESIZABLE, GL_TRUE);
 
-	// Create a GLFWwindow object that we can use for GLFW's functions
-	GLFWwindow *window = glfwCreateWindow(WIDTH, HEIGHT, "Solar System", glfwGetPrimaryMonitor(), nullptr);
+	// Create a GLFWwindow object that we can use for GLFW's functions. Try 4.3 first for multi-draw indirect, 3.3 is
+	// enough for everything else.
+	const int contextVersions[2][2] = { { 4, 3 }, { 3, 3 } };
+	GLFWwindow *window = nullptr;
+
+	for (int i = 0; i < 2 && nullptr == window; i++)
+	{
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, contextVersions[i][0]);
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, contextVersions[i][1]);
+		window = glfwCreateWindow(WIDTH, HEIGHT, "Solar System", FULL_SCREEN ? glfwGetPrimaryMonitor() : nullptr, nullptr);
+	}
 
 	if (nullptr == window)
 	{
@@ -81,6 +144,8 @@ int main()
 	// Set the required callback functions
 	glfwSetKeyCallback(window, KeyCallback);
 	glfwSetCursorPosCallback(window, MouseCallback);
+	glfwSetScrollCallback(window, ScrollCallback);
+	glfwSetFramebufferSizeCallback(window, FramebufferSizeCallback);
 
 	// GLFW Options
 	glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
@@ -97,237 +162,555 @@ int main()
 	// Define the viewport dimensions
 	glViewport(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT);
 
-	// OpenGL options
-	glEnable(GL_DEPTH_TEST);
-
-	SoundEngine->play2D("audio/Adagio.mp3", GL_TRUE);
-
-	Shader shader("modelLoadingVertex.txt", "modelLoadingFrag.txt");
-	Shader skyboxShader("skyboxVertex.txt", "skyboxFrag.txt");
-
-
-	Model earthModel("models/Earth.obj");
-	Model moonModel("models/Moon.obj");
-	Model marsModel("models/Mars 2K.obj");
-	Model sunModel("models/inSun.obj");
-	Model mercuryModel("models/Mercury 2K.obj");
-	Model venusModel("models/Venus 2K.obj");
-	Model jupiterModel("models/Jupiter 2K.obj");
-	Model saturnModel("models/Saturn.obj");
-	Model uranusModel("models/hoth.obj");
-	Model neptuneModel("models/yavin-IV.obj");
-
-	GLfloat skyboxVertices[] = {
-		// Positions
-		-1.0f,  1.0f, -1.0f,
-		-1.0f, -1.0f, -1.0f,
-		1.0f, -1.0f, -1.0f,
-		1.0f, -1.0f, -1.0f,
-		1.0f,  1.0f, -1.0f,
-		-1.0f,  1.0f, -1.0f,
-
-		-1.0f, -1.0f,  1.0f,
-		-1.0f, -1.0f, -1.0f,
-		-1.0f,  1.0f, -1.0f,
-		-1.0f,  1.0f, -1.0f,
-		-1.0f,  1.0f,  1.0f,
-		-1.0f, -1.0f,  1.0f,
-
-		1.0f, -1.0f, -1.0f,
-		1.0f, -1.0f,  1.0f,
-		1.0f,  1.0f,  1.0f,
-		1.0f,  1.0f,  1.0f,
-		1.0f,  1.0f, -1.0f,
-		1.0f, -1.0f, -1.0f,
-
-		-1.0f, -1.0f,  1.0f,
-		-1.0f,  1.0f,  1.0f,
-		1.0f,  1.0f,  1.0f,
-		1.0f,  1.0f,  1.0f,
-		1.0f, -1.0f,  1.0f,
-		-1.0f, -1.0f,  1.0f,
-
-		-1.0f,  1.0f, -1.0f,
-		1.0f,  1.0f, -1.0f,
-		1.0f,  1.0f,  1.0f,
-		1.0f,  1.0f,  1.0f,
-		-1.0f,  1.0f,  1.0f,
-		-1.0f,  1.0f, -1.0f,
-
-		-1.0f, -1.0f, -1.0f,
-		-1.0f, -1.0f,  1.0f,
-		1.0f, -1.0f, -1.0f,
-		1.0f, -1.0f, -1.0f,
-		-1.0f, -1.0f,  1.0f,
-		1.0f, -1.0f,  1.0f
-	};
-
-	// Setup skybox VAO
-	GLuint skyboxVAO, skyboxVBO;
-	glGenVertexArrays(1, &skyboxVAO);
-	glGenBuffers(1, &skyboxVBO);
-	glBindVertexArray(skyboxVAO);
-	glBindBuffer(GL_ARRAY_BUFFER, skyboxVBO);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(skyboxVertices), &skyboxVertices, GL_STATIC_DRAW);
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), (GLvoid *)0);
-	glBindVertexArray(0);
-
-	//Load textures
-	vector<const GLchar *>faces;
-	faces.push_back("skybox/starfield_bk.tga");
-	faces.push_back("skybox/starfield_dn.tga");
-	faces.push_back("skybox/starfield_ft.tga");
-	faces.push_back("skybox/starfield_lf.tga");
-	faces.push_back("skybox/starfield_rt.tga");
-	faces.push_back("skybox/starfield_up.tga");
-
-	GLuint cubemapTexture = TextureLoading::LoadCubemap(faces);
-
-	glm::mat4 projection(1);
-	projection = glm::perspective(camera.GetZoom(), (float)SCREEN_WIDTH / (float)SCREEN_HEIGHT, 0.1f, 1000.0f);
-
-	// Game loop
-	while (!glfwWindowShouldClose(window))
+	int exitStatus = EXIT_SUCCESS;
+
+	// Everything that owns GL objects lives in this scope, so their destructors run while the context still exists
 	{
-		// Set frame time
-		GLfloat currentFrame = glfwGetTime();
-		deltaTime = currentFrame - lastFrame;
-		lastFrame = currentFrame;
-
-		// Check and call events
-		glfwPollEvents();
-		DoMovement();
-
-		// Clear the colorbuffer
-		glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		// OpenGL options
+		glEnable(GL_DEPTH_TEST);
+
+		// Reverse-Z into a float depth buffer where glClipControl is available, the usual depth mapping in the window's
+		// depth buffer otherwise. Both put the far plane at infinity, see Camera::GetProjectionMatrix.
+		std::unique_ptr<SceneFramebuffer> sceneFramebuffer;
+		GLenum depthFunc = GL_LESS;
+		// The skybox sits exactly on the far plane, it has to pass wherever nothing nearer was drawn
+		GLenum skyboxDepthFunc = GL_LEQUAL;
+
+		// Goes back to the standard mapping in the window's depth buffer if the float one can't be had
+		auto dropSceneFramebuffer = [&]()
+		{
+			std::cout << "WARNING::SCENE_FRAMEBUFFER:: falling back to standard depth in the window's buffer" << std::endl;
+			sceneFramebuffer.reset();
+			glClipControl(GL_LOWER_LEFT, GL_NEGATIVE_ONE_TO_ONE);
+			glClearDepth(1.0);
+			depthFunc = GL_LESS;
+			skyboxDepthFunc = GL_LEQUAL;
+			glDepthFunc(depthFunc);
+			camera.SetReverseZ(false);
+		};
+
+		if (SceneFramebuffer::IsReverseZSupported())
+		{
+			sceneFramebuffer.reset(new SceneFramebuffer(SCREEN_WIDTH, SCREEN_HEIGHT));
+			glClipControl(GL_LOWER_LEFT, GL_ZERO_TO_ONE);
+			glClearDepth(0.0);
+			depthFunc = GL_GREATER;
+			skyboxDepthFunc = GL_GEQUAL;
+			camera.SetReverseZ(true);
+
+			if (!sceneFramebuffer->IsComplete())
+			{
+				dropSceneFramebuffer();
+			}
+		}
+
+		glDepthFunc(depthFunc);
+		std::cout << "Depth: " << (camera.IsReverseZ() ? "reverse-Z in a 32-bit float buffer" : "standard in the window's buffer") << ", infinite far plane"
+			<< std::endl;
+
+		SoundEngine->play2D("audio/Adagio.mp3", GL_TRUE);
+
+		Shader shader("modelLoadingVertex.txt", "modelLoadingFrag.txt");
+		Shader skyboxShader("skyboxVertex.txt", "skyboxFrag.txt");
+		Shader instancedShader("modelLoadingInstancedVertex.txt", "modelLoadingFrag.txt");
+		Shader asteroidShader("asteroidVertex.txt", "asteroidFrag.txt");
+		std::unique_ptr<Shader> indirectShader;
+		// Same, but sampling every planet from the MaterialPacker's array
+		std::unique_ptr<Shader> arrayShader;
+
+		if (SceneRenderer::IsIndirectSupported())
+		{
+			indirectShader.reset(new Shader("modelLoadingIndirectVertex.txt", "modelLoadingFrag.txt"));
+			arrayShader.reset(new Shader("modelLoadingIndirectVertex.txt", "modelLoadingArrayFrag.txt"));
+			arrayShader->Use();
+			arrayShader->setInt("texture_array", 0);
+		}
+
+
+		// Startup timing, compare a cold run (no .meshcache files) with a warm one
+		GLfloat loadStart = glfwGetTime();
+
+		// Parse the models on worker threads. The GL upload happens here on the context thread, each model as soon as its
+		// import is done, while the later ones are still being imported. Textures are decoded on the same pool by the
+		// streamer and show a low resolution preview until they are fully uploaded.
+		ThreadPool loaderPool;
+		TextureStreamer textureStreamer(loaderPool);
+		// All planets share one vertex and one index buffer, so drawing them never switches VAOs
+		GeometryArena geometryArena;
+		auto importModel = [&loaderPool](const char *path) { return loaderPool.Enqueue([path]() { return Model::Import(path, false); }); };
+
+		std::future<ModelData> earthData = importModel("models/Earth.obj");
+		std::future<ModelData> moonData = importModel("models/Moon.obj");
+		std::future<ModelData> marsData = importModel("models/Mars 2K.obj");
+		std::future<ModelData> sunData = importModel("models/inSun.obj");
+		std::future<ModelData> mercuryData = importModel("models/Mercury 2K.obj");
+		std::future<ModelData> venusData = importModel("models/Venus 2K.obj");
+		std::future<ModelData> jupiterData = importModel("models/Jupiter 2K.obj");
+		std::future<ModelData> saturnData = importModel("models/Saturn.obj");
+		std::future<ModelData> uranusData = importModel("models/hoth.obj");
+		std::future<ModelData> neptuneData = importModel("models/yavin-IV.obj");
+
+		// The uploads take the imported vertex and index buffers over rather than copying them, count what they allocate
+		size_t uploadAllocations = AllocationCounter::Get();
+
+		Model earthModel(earthData.get(), &textureStreamer, &geometryArena, MODEL_RESIDENCY);
+		Model moonModel(moonData.get(), &textureStreamer, &geometryArena, MODEL_RESIDENCY);
+		Model marsModel(marsData.get(), &textureStreamer, &geometryArena, MODEL_RESIDENCY);
+		Model sunModel(sunData.get(), &textureStreamer, &geometryArena, MODEL_RESIDENCY);
+		Model mercuryModel(mercuryData.get(), &textureStreamer, &geometryArena, MODEL_RESIDENCY);
+		Model venusModel(venusData.get(), &textureStreamer, &geometryArena, MODEL_RESIDENCY);
+		Model jupiterModel(jupiterData.get(), &textureStreamer, &geometryArena, MODEL_RESIDENCY);
+		Model saturnModel(saturnData.get(), &textureStreamer, &geometryArena, MODEL_RESIDENCY);
+		Model uranusModel(uranusData.get(), &textureStreamer, &geometryArena, MODEL_RESIDENCY);
+		Model neptuneModel(neptuneData.get(), &textureStreamer, &geometryArena, MODEL_RESIDENCY);
+
+		uploadAllocations = AllocationCounter::Get() - uploadAllocations;
+
+		std::cout << "Loaded all models in " << (glfwGetTime() - loadStart) * 1000.0 << " ms (" << geometryArena.GetVertexCount() << " vertices, "
+			<< geometryArena.GetIndexCount() << " indices in the geometry arena)" << std::endl;
+
+		if (AllocationCounter::IsEnabled())
+		{
+			std::cout << "Model uploads: " << uploadAllocations << " heap allocations on the render thread" << std::endl;
+		}
+		std::cout << "Textures: " << TextureRegistry::Instance().GetLoads() << " files loaded for " << TextureRegistry::Instance().GetRequests()
+			<< " material slots" << std::endl;
+
+		SceneRenderer sceneRenderer(geometryArena);
+		std::cout << "Scene submission: " << (sceneRenderer.IsIndirect() ? "multi-draw indirect" : "GL 3.3 fallback") << " (M toggles it off and on)" << std::endl;
+
+		// Look up every mesh's sampler uniforms for each shader it is drawn with now, rather than on its first draw
+		Model *planets[] = { &sunModel, &mercuryModel, &venusModel, &earthModel, &marsModel, &jupiterModel, &saturnModel, &uranusModel, &neptuneModel };
+
+		for (GLuint i = 0; i < sizeof(planets) / sizeof(planets[0]); i++)
+		{
+			planets[i]->PrepareShader(shader);
+
+			if (indirectShader)
+			{
+				planets[i]->PrepareShader(*indirectShader);
+			}
+		}
+
+		moonModel.PrepareShader(instancedShader);
+
+		// The planets' textures are copied into one array once they have all streamed in, see the game loop
+		MaterialPacker materialPacker;
+		bool packMaterials = MaterialPacker::IsSupported();
+
+		for (GLuint i = 0; i < sizeof(planets) / sizeof(planets[0]); i++)
+		{
+			materialPacker.Add(*planets[i]);
+		}
+
+		// Geometry memory per model, with RESIDENCY_KEEP the CPU side would match the GPU side
+		Model *models[] = { &sunModel, &mercuryModel, &venusModel, &earthModel, &moonModel, &marsModel, &jupiterModel, &saturnModel, &uranusModel, &neptuneModel };
+
+		for (GLuint i = 0; i < sizeof(models) / sizeof(models[0]); i++)
+		{
+			std::cout << models[i]->GetPath() << ": " << models[i]->GetCPUBytes() / 1024 << " KB geometry in system memory, " << models[i]->GetGPUBytes() / 1024
+				<< " KB on the GPU" << std::endl;
+		}
+
+		// Mars orbits at a radius of about 75 and Jupiter at about 120
+		AsteroidBelt asteroidBelt(loaderPool, asteroidCount, 85.0f, 110.0f);
+
+		GLfloat skyboxVertices[] = {
+			// Positions
+			-1.0f,  1.0f, -1.0f,
+			-1.0f, -1.0f, -1.0f,
+			1.0f, -1.0f, -1.0f,
+			1.0f, -1.0f, -1.0f,
+			1.0f,  1.0f, -1.0f,
+			-1.0f,  1.0f, -1.0f,
+
+			-1.0f, -1.0f,  1.0f,
+			-1.0f, -1.0f, -1.0f,
+			-1.0f,  1.0f, -1.0f,
+			-1.0f,  1.0f, -1.0f,
+			-1.0f,  1.0f,  1.0f,
+			-1.0f, -1.0f,  1.0f,
+
+			1.0f, -1.0f, -1.0f,
+			1.0f, -1.0f,  1.0f,
+			1.0f,  1.0f,  1.0f,
+			1.0f,  1.0f,  1.0f,
+			1.0f,  1.0f, -1.0f,
+			1.0f, -1.0f, -1.0f,
+
+			-1.0f, -1.0f,  1.0f,
+			-1.0f,  1.0f,  1.0f,
+			1.0f,  1.0f,  1.0f,
+			1.0f,  1.0f,  1.0f,
+			1.0f, -1.0f,  1.0f,
+			-1.0f, -1.0f,  1.0f,
+
+			-1.0f,  1.0f, -1.0f,
+			1.0f,  1.0f, -1.0f,
+			1.0f,  1.0f,  1.0f,
+			1.0f,  1.0f,  1.0f,
+			-1.0f,  1.0f,  1.0f,
+			-1.0f,  1.0f, -1.0f,
+
+			-1.0f, -1.0f, -1.0f,
+			-1.0f, -1.0f,  1.0f,
+			1.0f, -1.0f, -1.0f,
+			1.0f, -1.0f, -1.0f,
+			-1.0f, -1.0f,  1.0f,
+			1.0f, -1.0f,  1.0f
+		};
+
+		// Setup skybox VAO
+		GLuint skyboxVAO, skyboxVBO;
+		glGenVertexArrays(1, &skyboxVAO);
+		glGenBuffers(1, &skyboxVBO);
+		glBindVertexArray(skyboxVAO);
+		glBindBuffer(GL_ARRAY_BUFFER, skyboxVBO);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(skyboxVertices), &skyboxVertices, GL_STATIC_DRAW);
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), (GLvoid *)0);
+		glBindVertexArray(0);
+
+		//Load textures
+		vector<const GLchar *>faces;
+		faces.push_back("skybox/starfield_bk.tga");
+		faces.push_back("skybox/starfield_dn.tga");
+		faces.push_back("skybox/starfield_ft.tga");
+		faces.push_back("skybox/starfield_lf.tga");
+		faces.push_back("skybox/starfield_rt.tga");
+		faces.push_back("skybox/starfield_up.tga");
+
+		GLuint cubemapTexture = TextureLoading::LoadCubemap(faces, &loaderPool);
+
+		camera.SetAspectRatio((float)SCREEN_WIDTH / (float)SCREEN_HEIGHT);
+
+		// The moons share one model, so they are gathered up during the frame and drawn instanced at the end
+		InstanceBuffer moonInstances;
+		vector<InstanceData> moons;
+		// Orbit radii of Jupiter's four largest moons, in Jupiter's model space
+		const GLfloat galileanOrbits[4] = { 2.0f, 2.6f, 3.4f, 4.4f };
+
+		GLfloat loopStart = glfwGetTime();
+		GLuint frameCount = 0;
+
+		// CPU time spent submitting the planets, [0] through the RenderQueue, [1] through the SceneRenderer
+		double submissionMs[2] = { 0.0, 0.0 };
+		GLuint submissionFrames[2] = { 0, 0 };
+
+		RenderQueue renderQueue;
+		StateTracker stateTracker;
+		// State changes the tracker issued and skipped, summed over the frames the RenderQueue was used
+		double stateChangesIssued = 0.0, stateChangesSkipped = 0.0;
+		// Heap allocations on the render thread over whole steady state frames, see ALLOCATION_CHECK_FRAMES. Must stay 0.
+		size_t steadyStateAllocations = 0;
+		GLuint steadyStateFrames = 0;
+
+		auto drawPlanet = [&](Model &planet, const glm::dmat4 &world)
+		{
+			glm::mat4 transform = camera.GetRelativeTransform(world);
+
+			if (sceneSubmission)
+			{
+				sceneRenderer.Submit(planet, transform);
+			}
+			else
+			{
+				renderQueue.Submit(shader, planet, transform);
+			}
+		};
+
+		// Game loop
+		while (!glfwWindowShouldClose(window))
+		{
+			// Frames that may still stream textures or pack materials allocate as part of loading
+			bool loading = packMaterials || !textureStreamer.IsIdle();
+			size_t allocationsBefore = AllocationCounter::Get();
+
+			// Set frame time
+			GLfloat currentFrame = glfwGetTime();
+			deltaTime = currentFrame - lastFrame;
+			lastFrame = currentFrame;
+
+			// Check and call events
+			glfwPollEvents();
+			DoMovement();
+
+			// Nothing to draw into while minimised (0x0)
+			if (framebufferResized && SCREEN_WIDTH > 0 && SCREEN_HEIGHT > 0)
+			{
+				framebufferResized = false;
+				glViewport(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT);
+				camera.SetAspectRatio((float)SCREEN_WIDTH / (float)SCREEN_HEIGHT);
+
+				if (sceneFramebuffer && !sceneFramebuffer->Resize(SCREEN_WIDTH, SCREEN_HEIGHT))
+				{
+					dropSceneFramebuffer();
+				}
+			}
+
+			// Upload whatever textures have finished decoding, within this frame's budget
+			textureStreamer.Update();
+
+			if (packMaterials && textureStreamer.IsIdle())
+			{
+				packMaterials = false;
+
+				if (materialPacker.Pack())
+				{
+					sceneRenderer.SetMaterials(&materialPacker);
+					std::cout << "Packed " << materialPacker.GetMaterialCount() << " planet materials into " << materialPacker.GetLayerCount() << " array layers of "
+						<< materialPacker.GetWidth() << "x" << materialPacker.GetHeight() << " (" << materialPacker.GetAtlasLayerCount() << " of them atlases), "
+						<< materialPacker.GetBytes() / 1024 << " KB" << std::endl;
+				}
+			}
+
+			asteroidBelt.Update(currentFrame);
+
+			if (sceneFramebuffer)
+			{
+				sceneFramebuffer->Bind();
+			}
+
+			// Clear the colorbuffer
+			glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 		
-		glm::mat4 view(1);
-		view = camera.GetViewMatrix();
-
-		shader.Use();
-
-		glUniformMatrix4fv(glGetUniformLocation(shader.Program, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
-		glUniformMatrix4fv(glGetUniformLocation(shader.Program, "view"), 1, GL_FALSE, glm::value_ptr(view));
-
-		glm::mat4 model(1);
-		model = glm::scale(model, glm::vec3(5.0f, 5.0f, 5.0f));
-		model = glm::rotate(model, (GLfloat)glfwGetTime() * 0.08f, glm::vec3(0.0f, 1.0f, 0.0f));
-		model = glm::translate(model, glm::vec3(0.0f, 0.0f, 0.0f));
-		glUniformMatrix4fv(glGetUniformLocation(shader.Program, "model"), 1, GL_FALSE, glm::value_ptr(model));
-		sunModel.Draw(shader); //sun
-
-		glm::mat4 model1(1);
-		model1 = glm::scale(model1, glm::vec3(0.5f, 0.5f, 0.5f));
-		model1 = glm::rotate(model1, (GLfloat)glfwGetTime() * 0.5f, glm::vec3(0.0f, 1.0f, 0.0f));
-		model1 = glm::translate(model1, glm::vec3(-34.0f, 0.0f, -16.0f));
-		model1 = glm::rotate(model1, (GLfloat)glfwGetTime() * 0.3f, glm::vec3(1.0f, 0.0f, 1.0f));
-		glUniformMatrix4fv(glGetUniformLocation(shader.Program, "model"), 1, GL_FALSE, glm::value_ptr(model1));
-		mercuryModel.Draw(shader); // mercury
-
-		glm::mat4 model2(1);
+			const glm::mat4 &viewProjection = camera.GetViewProjectionMatrix();
+			glm::vec3 relativeLightPos = camera.GetRelativePosition(lightPos);
+
+			shader.Use();
+
+			shader.setMat4("viewProjection", viewProjection);
+
+			std::chrono::steady_clock::time_point submissionStart = std::chrono::steady_clock::now();
+
+			// World transforms are built in double precision and only rounded to float once they are relative to the camera
+			double time = glfwGetTime();
+
+			glm::dmat4 model(1);
+			model = glm::scale(model, glm::dvec3(5.0, 5.0, 5.0));
+			model = glm::rotate(model, time * 0.08, glm::dvec3(0.0, 1.0, 0.0));
+			model = glm::translate(model, glm::dvec3(0.0, 0.0, 0.0));
+			drawPlanet(sunModel, model); //sun
+
+			glm::dmat4 model1(1);
+			model1 = glm::scale(model1, glm::dvec3(0.5, 0.5, 0.5));
+			model1 = glm::rotate(model1, time * 0.5, glm::dvec3(0.0, 1.0, 0.0));
+			model1 = glm::translate(model1, glm::dvec3(-34.0, 0.0, -16.0));
+			model1 = glm::rotate(model1, time * 0.3, glm::dvec3(1.0, 0.0, 1.0));
+			drawPlanet(mercuryModel, model1); // mercury
+
+			glm::dmat4 model2(1);
 		
-		model2 = glm::scale(model2, glm::vec3(0.8f, 0.8f, 0.8f));
-		model2 = glm::rotate(model2, (GLfloat)glfwGetTime() * 0.3f, glm::vec3(0.0f, 1.0f, 0.0f));
-		model2 = glm::translate(model2, glm::vec3(50.0f, 0.0f, -32.0f));
-		model2 = glm::rotate(model2, (GLfloat)glfwGetTime() * 0.3f, glm::vec3(1.0f, 0.0f, 1.0f));
-		glUniformMatrix4fv(glGetUniformLocation(shader.Program, "model"), 1, GL_FALSE, glm::value_ptr(model2));
-		venusModel.Draw(shader); // venus
-
-		glm::mat4 model3(1);
-
-		model3 = glm::rotate(model3, (GLfloat)glfwGetTime() * 0.5f, glm::vec3(0.0f, 1.0f, 0.0f));
-		model3 = glm::translate(model3, glm::vec3(0.0f, 0.0f, -58.0f));
-		glUniformMatrix4fv(glGetUniformLocation(shader.Program, "model"), 1, GL_FALSE, glm::value_ptr(model3));
-		earthModel.Draw(shader);// earth
-
-		glm::mat4 model4(1);
-
-		model4 = glm::scale(model4, glm::vec3(0.006f, 0.006f, 0.006f));
-		model4 = glm::rotate(model3 * model4, (GLfloat)glfwGetTime() * 0.1f, glm::vec3(0.0f, 1.0f, 0.0f));
-		model4 = glm::translate(model4, glm::vec3(13.0f, 0.0f, -67.0f));
-		model4 = glm::rotate(model4, (GLfloat)glfwGetTime() * 0.8f, glm::vec3(0.0f, 1.0f, 0.0f));
-		glUniformMatrix4fv(glGetUniformLocation(shader.Program, "model"), 1, GL_FALSE, glm::value_ptr(model4));
-		moonModel.Draw(shader); //moon
+			model2 = glm::scale(model2, glm::dvec3(0.8, 0.8, 0.8));
+			model2 = glm::rotate(model2, time * 0.3, glm::dvec3(0.0, 1.0, 0.0));
+			model2 = glm::translate(model2, glm::dvec3(50.0, 0.0, -32.0));
+			model2 = glm::rotate(model2, time * 0.3, glm::dvec3(1.0, 0.0, 1.0));
+			drawPlanet(venusModel, model2); // venus
+
+			glm::dmat4 model3(1);
+
+			model3 = glm::rotate(model3, time * 0.5, glm::dvec3(0.0, 1.0, 0.0));
+			model3 = glm::translate(model3, glm::dvec3(0.0, 0.0, -58.0));
+			drawPlanet(earthModel, model3);// earth
+
+			glm::dmat4 model4(1);
+
+			model4 = glm::scale(model4, glm::dvec3(0.006, 0.006, 0.006));
+			model4 = glm::rotate(model3 * model4, time * 0.1, glm::dvec3(0.0, 1.0, 0.0));
+			model4 = glm::translate(model4, glm::dvec3(13.0, 0.0, -67.0));
+			model4 = glm::rotate(model4, time * 0.8, glm::dvec3(0.0, 1.0, 0.0));
+			moons.clear();
+			moons.push_back(InstanceData(camera.GetRelativeTransform(model4))); //moon
 		
-		glm::mat4 model5(1);
+			glm::dmat4 model5(1);
 
-		model5 = glm::scale(model5, glm::vec3(0.6f, 0.6f, 0.6f));
-		model5 = glm::rotate(model5, (GLfloat)glfwGetTime() * 0.5f, glm::vec3(0.0f, 1.0f, 0.0f));
-		model5 = glm::translate(model5, glm::vec3(-35.0f, 0.0f, -120.0f));
-		model5 = glm::rotate(model5, (GLfloat)glfwGetTime() * 0.3f, glm::vec3(1.0f, 0.0f, 1.0f));
-		glUniformMatrix4fv(glGetUniformLocation(shader.Program, "model"), 1, GL_FALSE, glm::value_ptr(model5));
-		marsModel.Draw(shader); // mars
+			model5 = glm::scale(model5, glm::dvec3(0.6, 0.6, 0.6));
+			model5 = glm::rotate(model5, time * 0.5, glm::dvec3(0.0, 1.0, 0.0));
+			model5 = glm::translate(model5, glm::dvec3(-35.0, 0.0, -120.0));
+			model5 = glm::rotate(model5, time * 0.3, glm::dvec3(1.0, 0.0, 1.0));
+			drawPlanet(marsModel, model5); // mars
 
-		glm::mat4 model6(1);
+			glm::dmat4 model6(1);
 		
-		model6 = glm::scale(model6, glm::vec3(3.3f, 3.3f, 3.3f));
-		model6 = glm::rotate(model6, (GLfloat)glfwGetTime() * 0.3f, glm::vec3(0.0f, 1.0f, 0.0f));
-		model6 = glm::translate(model6, glm::vec3(-21.0f, 0.0f, -30.0f));
-		model6 = glm::rotate(model6, (GLfloat)glfwGetTime() * 0.3f, glm::vec3(3.0f, 0.0f, 2.0f));
-		glUniformMatrix4fv(glGetUniformLocation(shader.Program, "model"), 1, GL_FALSE, glm::value_ptr(model6));
-		jupiterModel.Draw(shader); //jupiter
-
-
-		glm::mat4 model7(1);
-		model7 = glm::scale(model7, glm::vec3(0.05f, 0.05f, 0.05f));
-		model7 = glm::rotate(model7, (GLfloat)glfwGetTime() * 0.4f, glm::vec3(0.0f, 1.0f, 0.0f));
-		model7 = glm::translate(model7, glm::vec3(-2000.0f, 0.0f, -6030.0f));
-		model7 = glm::rotate(model7, (GLfloat)glfwGetTime() * 0.5f, glm::vec3(2.0f, 3.0f, 3.0f));
-		glUniformMatrix4fv(glGetUniformLocation(shader.Program, "model"), 1, GL_FALSE, glm::value_ptr(model7));
-		saturnModel.Draw(shader); // saturn
-
-		glm::mat4 model8(1);
-		model8 = glm::scale(model8, glm::vec3(0.25f, 0.25f, 0.25f));
-		model8 = glm::rotate(model8, (GLfloat)glfwGetTime() * 0.2f, glm::vec3(0.0f, 1.0f, 0.0f));
-		model8 = glm::translate(model8, glm::vec3(1550.0f, 0.0f, -1450.0f));
-		model8 = glm::rotate(model8, (GLfloat)glfwGetTime() * 0.5f, glm::vec3(1.0f, 0.0f, 1.0f));
-		glUniformMatrix4fv(glGetUniformLocation(shader.Program, "model"), 1, GL_FALSE, glm::value_ptr(model8));
-		uranusModel.Draw(shader); // uranus
-
-		glm::mat4 model9(1);
-		model9 = glm::scale(model9, glm::vec3(0.2f, 0.2f, 0.2f));
-		model9 = glm::rotate(model9, (GLfloat)glfwGetTime() * 0.2f, glm::vec3(0.0f, 1.0f, 0.0f));
-		model9 = glm::translate(model9, glm::vec3(0.0f, 0.0f, -2250.0f));
-		model9 = glm::rotate(model9, (GLfloat)glfwGetTime() * 0.5f, glm::vec3(1.0f, 0.0f, 1.0f));
-		glUniformMatrix4fv(glGetUniformLocation(shader.Program, "model"), 1, GL_FALSE, glm::value_ptr(model9));
-		neptuneModel.Draw(shader); // uranus
+			model6 = glm::scale(model6, glm::dvec3(3.3, 3.3, 3.3));
+			model6 = glm::rotate(model6, time * 0.3, glm::dvec3(0.0, 1.0, 0.0));
+			model6 = glm::translate(model6, glm::dvec3(-21.0, 0.0, -30.0));
+			model6 = glm::rotate(model6, time * 0.3, glm::dvec3(3.0, 0.0, 2.0));
+			drawPlanet(jupiterModel, model6); //jupiter
+
+			if (galileanMoons)
+			{
+				for (GLuint i = 0; i < 4; i++)
+				{
+					glm::dmat4 galilean = glm::rotate(model6, time * (1.2 - 0.25 * i), glm::dvec3(0.0, 1.0, 0.0));
+					galilean = glm::translate(galilean, glm::dvec3(galileanOrbits[i], 0.0, 0.0));
+					galilean = glm::scale(galilean, glm::dvec3(0.0015, 0.0015, 0.0015));
+					moons.push_back(InstanceData(camera.GetRelativeTransform(galilean))); // jupiter's moons
+				}
+			}
+
+
+			glm::dmat4 model7(1);
+			model7 = glm::scale(model7, glm::dvec3(0.05, 0.05, 0.05));
+			model7 = glm::rotate(model7, time * 0.4, glm::dvec3(0.0, 1.0, 0.0));
+			model7 = glm::translate(model7, glm::dvec3(-2000.0, 0.0, -6030.0));
+			model7 = glm::rotate(model7, time * 0.5, glm::dvec3(2.0, 3.0, 3.0));
+			drawPlanet(saturnModel, model7); // saturn
+
+			glm::dmat4 model8(1);
+			model8 = glm::scale(model8, glm::dvec3(0.25, 0.25, 0.25));
+			model8 = glm::rotate(model8, time * 0.2, glm::dvec3(0.0, 1.0, 0.0));
+			model8 = glm::translate(model8, glm::dvec3(1550.0, 0.0, -1450.0));
+			model8 = glm::rotate(model8, time * 0.5, glm::dvec3(1.0, 0.0, 1.0));
+			drawPlanet(uranusModel, model8); // uranus
+
+			glm::dmat4 model9(1);
+			model9 = glm::scale(model9, glm::dvec3(0.2, 0.2, 0.2));
+			model9 = glm::rotate(model9, time * 0.2, glm::dvec3(0.0, 1.0, 0.0));
+			model9 = glm::translate(model9, glm::dvec3(0.0, 0.0, -2250.0));
+			model9 = glm::rotate(model9, time * 0.5, glm::dvec3(1.0, 0.0, 1.0));
+			drawPlanet(neptuneModel, model9); // uranus
 
 		
-		//Lighting Information
-		GLint objectColorLoc = glGetUniformLocation(shader.Program, "objectColor");
-		GLint lightColorLoc = glGetUniformLocation(shader.Program, "lightColor");
-		GLint lightPosLoc = glGetUniformLocation(shader.Program, "lightPos");
-		GLint viewPosLoc = glGetUniformLocation(shader.Program, "viewPos");
-		glUniform3f(objectColorLoc, 0.3f, 0.5f, 1.0f);
-		glUniform3f(lightColorLoc, 1.0f, 1.0f, 1.0f);
-		glUniform3f(lightPosLoc, lightPos.x, lightPos.y, lightPos.z);
-		glUniform3f(viewPosLoc, camera.GetPosition().x, camera.GetPosition().y, camera.GetPosition().z);
+			//Lighting Information
+			shader.setVec3("objectColor", 0.3f, 0.5f, 1.0f);
+			shader.setVec3("lightColor", 1.0f, 1.0f, 1.0f);
+			shader.setVec3("lightPos", relativeLightPos);
+			shader.setVec3("viewPos", glm::vec3(0.0f));
+
+			if (sceneSubmission)
+			{
+				Shader *sceneShader = sceneRenderer.IsUsingMaterialArray() ? arrayShader.get() : indirectShader.get();
+
+				if (sceneShader)
+				{
+					sceneShader->Use();
+					sceneShader->setMat4("viewProjection", viewProjection);
+					sceneShader->setVec3("objectColor", 0.3f, 0.5f, 1.0f);
+					sceneShader->setVec3("lightColor", 1.0f, 1.0f, 1.0f);
+					sceneShader->setVec3("lightPos", relativeLightPos);
+					sceneShader->setVec3("viewPos", glm::vec3(0.0f));
+				}
+
+				sceneRenderer.Draw(sceneShader ? *sceneShader : shader);
+			}
+			else
+			{
+				stateTracker.ResetCounters();
+				renderQueue.Flush(stateTracker);
+				stateChangesIssued += stateTracker.GetIssued();
+				stateChangesSkipped += stateTracker.GetSkipped();
+			}
+
+			submissionMs[sceneSubmission] += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - submissionStart).count();
+			submissionFrames[sceneSubmission]++;
+
+			// Every moon in one draw call per mesh
+			moonInstances.Update(moons);
+			instancedShader.Use();
+			instancedShader.setMat4("viewProjection", viewProjection);
+			instancedShader.setVec3("objectColor", 0.3f, 0.5f, 1.0f);
+			instancedShader.setVec3("lightColor", 1.0f, 1.0f, 1.0f);
+			instancedShader.setVec3("lightPos", relativeLightPos);
+			instancedShader.setVec3("viewPos", glm::vec3(0.0f));
+			moonModel.DrawInstanced(instancedShader, moonInstances);
+
+			// The whole asteroid belt in one draw call
+			asteroidShader.Use();
+			asteroidShader.setMat4("viewProjection", viewProjection);
+			asteroidShader.setVec3("rockColor", 0.45f, 0.4f, 0.35f);
+			asteroidShader.setVec3("lightColor", 1.0f, 1.0f, 1.0f);
+			asteroidShader.setVec3("lightPos", relativeLightPos);
+			asteroidShader.setVec3("viewPos", glm::vec3(0.0f));
+			// The belt is centred on the sun
+			asteroidShader.setVec3("origin", camera.GetRelativePosition(glm::dvec3(0.0)));
+			asteroidBelt.Draw();
 		
 		
-		// Draw skybox as last
+			// Draw skybox as last
+
+			glDepthFunc(skyboxDepthFunc);  // Change depth function so depth test passes when values are equal to depth buffer's content
+			skyboxShader.Use();
+			skyboxShader.setFloat("farDepth", camera.IsReverseZ() ? 0.0f : 1.0f);
+
+			// The view has no translation (see Camera.h), so the skybox can share the scene's matrix
+			skyboxShader.setMat4("viewProjection", viewProjection);
+
+			// skybox cube
+			glBindVertexArray(skyboxVAO);
+			glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture);
+			glDrawArrays(GL_TRIANGLES, 0, 36);
+			glBindVertexArray(0);
+			glDepthFunc(depthFunc); // Set depth function back
+
+			if (sceneFramebuffer)
+			{
+				sceneFramebuffer->BlitToScreen();
+			}
+
+			// Swap the buffers
+			glfwSwapBuffers(window);
+			frameCount++;
+
+			if (!loading && submissionFrames[sceneSubmission] > ALLOCATION_WARMUP_FRAMES)
+			{
+				steadyStateAllocations += AllocationCounter::Get() - allocationsBefore;
+				steadyStateFrames++;
+
+				if (AllocationCounter::IsEnabled() && ALLOCATION_CHECK_FRAMES == steadyStateFrames)
+				{
+					if (steadyStateAllocations)
+					{
+						std::cout << "ERROR::ALLOCATIONS:: " << steadyStateAllocations << " heap allocations on the render thread in " << ALLOCATION_CHECK_FRAMES
+							<< " steady state frames" << std::endl;
+						exitStatus = EXIT_FAILURE;
+						glfwSetWindowShouldClose(window, GL_TRUE);
+					}
+					else
+					{
+						std::cout << "Allocation check passed: no heap allocations on the render thread in " << ALLOCATION_CHECK_FRAMES << " steady state frames"
+							<< std::endl;
+					}
+				}
+			}
+		}
 
-		glDepthFunc(GL_LESS); // Set depth function back to default
-		glDepthFunc(GL_LEQUAL);  // Change depth function so depth test passes when values are equal to depth buffer's content
-		skyboxShader.Use();
+		for (int i = 0; i < 2; i++)
+		{
+			if (submissionFrames[i])
+			{
+				std::cout << "Planet submission via " << (i ? "SceneRenderer" : "RenderQueue") << ": " << submissionMs[i] / submissionFrames[i] << " ms CPU/frame over "
+					<< submissionFrames[i] << " frames" << std::endl;
+			}
+		}
 
-		view = glm::mat4(glm::mat3(camera.GetViewMatrix())); // remove translation from the view matrix
-		glUniformMatrix4fv(glGetUniformLocation(skyboxShader.Program, "view"), 1, GL_FALSE, glm::value_ptr(view));
-		glUniformMatrix4fv(glGetUniformLocation(skyboxShader.Program, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+		std::cout << "SceneRenderer draw calls last frame: " << sceneRenderer.GetLastCallCount() << std::endl;
 
-		// skybox cube
-		glBindVertexArray(skyboxVAO);
-		glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture);
-		glDrawArrays(GL_TRIANGLES, 0, 36);
-		glBindVertexArray(0);
+		if (submissionFrames[0])
+		{
+			std::cout << "RenderQueue state changes per frame: " << stateChangesIssued / submissionFrames[0] << " issued, " << stateChangesSkipped / submissionFrames[0]
+				<< " skipped as redundant" << std::endl;
+		}
+
+		if (AllocationCounter::IsEnabled())
+		{
+			std::cout << "Heap allocations on the render thread in " << steadyStateFrames << " steady state frames: " << steadyStateAllocations << std::endl;
+		}
+
+		asteroidBelt.PrintStats(frameCount ? (glfwGetTime() - loopStart) * 1000.0 / frameCount : 0.0, TARGET_FRAME_MS);
+
+		std::cout << "Streamed textures: " << textureStreamer.GetResidentBytes() / 1024 << " KB of video memory (" << textureStreamer.GetUncompressedBytes() / 1024
+			<< " KB as RGB8)" << std::endl;
+		std::cout << "Uniform cache misses: " << shader.GetUniformCacheMisses() << " (models), " << instancedShader.GetUniformCacheMisses() << " (instanced), " << skyboxShader.GetUniformCacheMisses() << " (skybox)" << std::endl;
 
-		// Swap the buffers
-		glfwSwapBuffers(window);
+		glDeleteVertexArrays(1, &skyboxVAO);
+		glDeleteBuffers(1, &skyboxVBO);
+		glDeleteTextures(1, &cubemapTexture);
 	}
 
 	glfwTerminate();
-	return 0;
+	return exitStatus;
 }
 
 // Moves/alters the camera positions based on user input
@@ -363,6 +746,11 @@ void KeyCallback(GLFWwindow *window, int key, int scancode, int action, int mode
 		glfwSetWindowShouldClose(window, GL_TRUE);
 	}
 
+	if (GLFW_KEY_M == key && GLFW_PRESS == action)
+	{
+		sceneSubmission = !sceneSubmission;
+	}
+
 	if (key >= 0 && key < 1024)
 	{
 		if (action == GLFW_PRESS)
@@ -392,4 +780,16 @@ void MouseCallback(GLFWwindow *window, double xPos, double yPos)
 	lastY = yPos;
 
 	camera.ProcessMouseMovement(xOffset, yOffset);
+}
+
+void ScrollCallback(GLFWwindow *window, double xOffset, double yOffset)
+{
+	camera.ProcessMouseScroll(yOffset);
+}
+
+void FramebufferSizeCallback(GLFWwindow *window, int width, int height)
+{
+	SCREEN_WIDTH = width;
+	SCREEN_HEIGHT = height;
+	framebufferResized = true;
 }
\ No newline at end of file